@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sched.h>
+
+/*
+ * Posts a burst of fixed-cost tasks with random deadlines, more than the
+ * workers can finish in time, and counts how many deadlines each policy meets.
+ * Under the priority policy the tasks get random static priorities, which is
+ * what a deadline-blind scheduler amounts to.  EDF is run twice: once letting
+ * late tasks run anyway, and once giving them an expiry at their deadline so
+ * that they are dropped instead.  There is a worker per CPU, since workers that
+ * have to share a CPU take longer than their tasks' costs say.
+ */
+
+#define	NTASKS		4096
+#define	COST_NS		20000
+#define	REPS		3
+
+/* Deadlines are spread over this fraction of the time the work takes. */
+#define	SPREAD		0.8
+
+typedef enum run_kind {
+	RUN_PRIORITY,
+	RUN_EDF,
+	RUN_EDF_EXPIRE
+} run_kind_t;
+
+static const char *run_names[] = { "priority", "edf", "edf+expiry" };
+
+static task_t tasks[NTASKS];
+static int nworkers;
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+static void
+work_func(void *arg, int thread_num)
+{
+	uint64_t until = now_ns() + COST_NS;
+
+	while (now_ns() < until)
+		continue;
+}
+
+static void
+run(run_kind_t kind, sched_stats_t *stp)
+{
+	sched_t sched;
+	sched_attr_t attr;
+	uint64_t span, deadline;
+	int i;
+
+	sched_attr_init(&attr, nworkers, NTASKS);
+	attr.stats = true;
+	attr.policy = kind == RUN_PRIORITY ? SCHED_POLICY_PRIORITY :
+	    SCHED_POLICY_EDF;
+	(void) sched_init_attr(&sched, &attr);
+
+	span = (uint64_t)(SPREAD * NTASKS * COST_NS / nworkers);
+	srand(1);
+
+	for (i = 0; i < NTASKS; i++) {
+		deadline = COST_NS + (uint64_t)rand() % span;
+
+		task_init(&tasks[i], (uint64_t)rand() % 100, work_func, NULL);
+		task_set_deadline(&tasks[i], deadline, COST_NS);
+
+		if (kind == RUN_EDF_EXPIRE)
+			task_set_expiry(&tasks[i], deadline);
+
+		(void) sched_post(&sched, &tasks[i], false);
+	}
+
+	sched_execute(&sched);
+	(void) sched_stats(&sched, stp);
+	sched_fini(&sched);
+}
+
+int
+main(int argc, char **argv)
+{
+	sched_stats_t stats;
+	uint64_t met, missed, expired, best;
+	run_kind_t kind;
+	int r;
+
+	if ((nworkers = (int)sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		nworkers = 1;
+
+	printf("%-12s%10s%10s%10s%10s\n", "policy", "met", "missed", "expired",
+	    "met %");
+
+	for (kind = RUN_PRIORITY; kind <= RUN_EDF_EXPIRE; kind++) {
+		best = met = missed = expired = 0;
+
+		for (r = 0; r < REPS; r++) {
+			run(kind, &stats);
+
+			if (stats.deadlines_met >= best) {
+				best = met = stats.deadlines_met;
+				missed = stats.deadlines_missed;
+				expired = stats.expired;
+			}
+
+			sched_stats_release(&stats);
+		}
+
+		printf("%-12s%10llu%10llu%10llu%9.1f%%\n", run_names[kind],
+		    (unsigned long long)met, (unsigned long long)missed,
+		    (unsigned long long)expired, 100.0 * met / NTASKS);
+	}
+
+	return (0);
+}
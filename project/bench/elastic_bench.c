@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sched.h>
+
+/*
+ * Posts a batch of tasks that each block for a while, as if on I/O, and only
+ * then starts the scheduler, on a pool of NWORKERS workers that may grow to
+ * `max_workers' while tasks are blocked.  With no room to grow, the batch
+ * takes NTASKS / NWORKERS times as long as one task does.  With room for a
+ * worker per task, every task should be blocked at once, and the batch should
+ * take about as long as one task.
+ */
+
+#define	NWORKERS	2
+#define	NTASKS		16
+#define	BLOCK_US	100000
+
+static const int max_workers[] = { 2, 4, 8, 16 };
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+static void
+block_func(void *arg, int thread_num)
+{
+	sched_block_begin();
+	(void) usleep(BLOCK_US);
+	sched_block_end();
+}
+
+static uint64_t
+run(int max, int *threads)
+{
+	sched_t sched;
+	sched_attr_t attr;
+	task_t tasks[NTASKS];
+	uint64_t start;
+	int i;
+
+	sched_attr_init(&attr, NWORKERS, NTASKS);
+	attr.max_workers = max;
+
+	if (!sched_init_attr(&sched, &attr)) {
+		(void) fprintf(stderr, "sched_init_attr failed\n");
+		exit(1);
+	}
+
+	for (i = 0; i < NTASKS; i++) {
+		task_init(&tasks[i], SCHED_PRI_DEFAULT, block_func, NULL);
+		(void) sched_post(&sched, &tasks[i], false);
+	}
+
+	start = now_ns();
+	sched_execute(&sched);
+	start = now_ns() - start;
+	*threads = atomic_load(&sched.live_workers);
+	sched_fini(&sched);
+
+	return (start);
+}
+
+int
+main(int argc, char **argv)
+{
+	uint64_t base = 0, t;
+	int i, threads;
+
+	printf("%-14s%12s%10s%10s\n", "max workers", "ms", "speedup",
+	    "threads");
+
+	for (i = 0; i < sizeof (max_workers) / sizeof (int); i++) {
+		t = run(max_workers[i], &threads);
+
+		if (base == 0)
+			base = t;
+
+		printf("%-14d%12.1f%9.2fx%10d\n", max_workers[i], t / 1e6,
+		    (double)base / t, threads);
+	}
+
+	return (0);
+}
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <assert.h>
+#include <heap.h>
+
+/*
+ * Compares the scheduler's heap with the one it replaced, at sizes from 1e3
+ * up to 1e7 elements (or the size given on the command line).  Each size is
+ * filled with random keys, put through as many hold operations, a remove
+ * followed by an insert a little further out, and then drained.  Both are
+ * binary heaps, but the old one kept only an int per element and broke ties
+ * arbitrarily, while the new one's elements carry 64-bit keys, a sequence
+ * number to break ties and a position index, so this is the price of those.
+ * The best of REPS runs is reported for each.
+ */
+
+#define	MIN_SIZE	1000
+#define	MAX_SIZE	10000000
+#define	REPS		3
+
+/* The binary heap as it was, minus the parts the benchmark does not use. */
+typedef struct bheap_elem {
+	int val;
+	void *meta;
+} bheap_elem_t;
+
+typedef struct bheap {
+	int total;
+	bheap_elem_t *data;
+} bheap_t;
+
+static void
+bheap_sift_up(bheap_elem_t *array, int cur)
+{
+	int parent;
+	bheap_elem_t tmp;
+
+	for (tmp = array[cur]; cur > 0; cur = parent) {
+		parent = (cur - 1) / 2;
+
+		if (tmp.val >= array[parent].val)
+			break;
+
+		array[cur] = array[parent];
+	}
+
+	array[cur] = tmp;
+}
+
+static void
+bheap_sift_down(bheap_elem_t *array, int cur, int len)
+{
+	bheap_elem_t tmp;
+	int child;
+
+	for (tmp = array[cur]; cur * 2 + 1 < len; cur = child) {
+		child = cur * 2 + 1;
+
+		if (child != len - 1 && array[child].val > array[child + 1].val)
+			child++;
+
+		if (tmp.val <= array[child].val)
+			break;
+
+		array[cur] = array[child];
+	}
+
+	array[cur] = tmp;
+}
+
+static void
+bheap_insert(bheap_t *hp, bheap_elem_t elem)
+{
+	hp->data[hp->total] = elem;
+	bheap_sift_up(hp->data, hp->total);
+	hp->total++;
+}
+
+static void
+bheap_remove(bheap_t *hp, bheap_elem_t *elem)
+{
+	*elem = hp->data[0];
+	hp->data[0] = hp->data[hp->total - 1];
+	bheap_sift_down(hp->data, 0, hp->total - 1);
+	hp->total--;
+}
+
+static uint64_t rng_state;
+
+static uint64_t
+rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return (rng_state);
+}
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/*
+ * Keys are kept below 2^30 so that the binary heap's int can hold them, and
+ * the two heaps see exactly the same sequence.
+ */
+#define	KEY_MASK	((1U << 30) - 1)
+#define	HOLD_MASK	((1U << 16) - 1)
+
+static double
+run_binary(int n)
+{
+	bheap_t heap;
+	bheap_elem_t elem;
+	uint64_t start;
+	int i;
+
+	if ((heap.data = malloc(sizeof (bheap_elem_t) * n)) == NULL) {
+		printf("Memory allocation failure.\n");
+		exit(-1);
+	}
+
+	heap.total = 0;
+	rng_state = 88172645463325252ULL;
+	start = now_ns();
+
+	for (i = 0; i < n; i++) {
+		elem.val = (int)(rng() & KEY_MASK);
+		elem.meta = NULL;
+		bheap_insert(&heap, elem);
+	}
+
+	for (i = 0; i < n; i++) {
+		bheap_remove(&heap, &elem);
+		elem.val = (elem.val + (int)(rng() & HOLD_MASK)) & KEY_MASK;
+		bheap_insert(&heap, elem);
+	}
+
+	for (i = 0; i < n; i++)
+		bheap_remove(&heap, &elem);
+
+	start = now_ns() - start;
+	free(heap.data);
+	return ((double)start / (4.0 * n));
+}
+
+static double
+run_heap(int n)
+{
+	heap_t *hp;
+	heap_elem_t elem;
+	uint64_t start;
+	int i;
+
+	if ((hp = heap_create(n)) == NULL) {
+		printf("Memory allocation failure.\n");
+		exit(-1);
+	}
+
+	bzero(&elem, sizeof (heap_elem_t));
+	rng_state = 88172645463325252ULL;
+	start = now_ns();
+
+	for (i = 0; i < n; i++) {
+		elem.val = rng() & KEY_MASK;
+		(void) heap_insert(hp, elem);
+	}
+
+	for (i = 0; i < n; i++) {
+		(void) heap_remove(hp, &elem);
+		elem.val = (elem.val + (rng() & HOLD_MASK)) & KEY_MASK;
+		(void) heap_insert(hp, elem);
+	}
+
+	for (i = 0; i < n; i++)
+		(void) heap_remove(hp, &elem);
+
+	start = now_ns() - start;
+	heap_destroy(hp);
+	return ((double)start / (4.0 * n));
+}
+
+static double
+best(double (*run)(int), int n)
+{
+	double t, min = 0;
+	int r;
+
+	for (r = 0; r < REPS; r++) {
+		if ((t = run(n)) < min || r == 0)
+			min = t;
+	}
+
+	return (min);
+}
+
+int
+main(int argc, char **argv)
+{
+	int n, max = MAX_SIZE;
+	double old, new;
+
+	if (argc > 1 && (max = atoi(argv[1])) < MIN_SIZE)
+		max = MIN_SIZE;
+
+	printf("%-12s%14s%14s%10s\n", "elements", "old (ns)", "heap (ns)",
+	    "vs old");
+
+	for (n = MIN_SIZE; n <= max; n *= 10) {
+		old = best(run_binary, n);
+		new = best(run_heap, n);
+		printf("%-12d%14.1f%14.1f%9.2fx\n", n, old, new, old / new);
+	}
+
+	return (0);
+}
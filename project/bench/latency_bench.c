@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <assert.h>
+#include <sched.h>
+
+/*
+ * Measures the time from sched_post() to the task starting to run, with the
+ * producer pausing between short bursts so that workers keep going idle.  This
+ * is the case that the idle policy matters for: a parked worker has to be
+ * woken by the kernel, while a spinning one just notices the task.
+ */
+
+#define	NWORKERS	4
+#define	QUEUE_DEPTH	1024
+#define	SAMPLES		(1 << 14)
+#define	BURST		4
+#define	GAP_NS		50000
+
+typedef struct sample {
+	task_t task;
+	uint64_t posted;
+	uint64_t started;
+} sample_t;
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+static void
+start_func(void *arg, int thread_num)
+{
+	sample_t *smp = arg;
+
+	smp->started = now_ns();
+}
+
+/*
+ * Sleeping would let the producer's own CPU go idle too, so wait it out.
+ */
+static void
+gap(void)
+{
+	uint64_t until = now_ns() + GAP_NS;
+
+	while (now_ns() < until)
+		continue;
+}
+
+static int
+compare(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+static void
+run(const char *name, int spin, sample_t *samples, uint64_t *lat)
+{
+	int i;
+	sched_t sched;
+	sched_attr_t attr;
+
+	sched_attr_init(&attr, NWORKERS, QUEUE_DEPTH);
+	attr.spin = spin;
+	(void) sched_init_attr(&sched, &attr);
+
+	for (i = 0; i < SAMPLES; i++) {
+		task_init(&samples[i].task, SCHED_PRI_DEFAULT, start_func,
+		    &samples[i]);
+		samples[i].posted = now_ns();
+
+		while (!sched_post(&sched, &samples[i].task, true))
+			continue;
+
+		if (i % BURST == BURST - 1)
+			gap();
+	}
+
+	sched_execute(&sched);
+	sched_fini(&sched);
+
+	for (i = 0; i < SAMPLES; i++)
+		lat[i] = samples[i].started - samples[i].posted;
+
+	qsort(lat, SAMPLES, sizeof (uint64_t), compare);
+
+	printf("%-12s%12.1f%12.1f%12.1f\n", name, lat[SAMPLES / 2] / 1e3,
+	    lat[SAMPLES * 99 / 100] / 1e3, lat[SAMPLES - 1] / 1e3);
+}
+
+int
+main(int argc, char **argv)
+{
+	sample_t *samples;
+	uint64_t *lat;
+
+	if ((samples = malloc(sizeof (sample_t) * SAMPLES)) == NULL ||
+	    (lat = malloc(sizeof (uint64_t) * SAMPLES)) == NULL) {
+		printf("Memory allocation failure.\n");
+		exit(-1);
+	}
+
+	printf("%-12s%12s%12s%12s\n", "idle", "p50 (us)", "p99 (us)",
+	    "max (us)");
+
+	run("park", 0, samples, lat);
+	run("spin-16", 16, samples, lat);
+	run("spin-64", 64, samples, lat);
+	run("adaptive", SCHED_SPIN_ADAPTIVE, samples, lat);
+
+	free(lat);
+	free(samples);
+	return (0);
+}
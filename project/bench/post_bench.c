@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <assert.h>
+#include <sched.h>
+
+/*
+ * Measures how many tasks per second external producer threads can post,
+ * comparing sched_post(), which takes the heap lock and signals a worker on
+ * every call, against the lock-free sched_post_fifo() lane.
+ */
+
+#define	NWORKERS	4
+#define	QUEUE_DEPTH	(1 << 16)
+#define	POSTS		(1 << 18)
+#define	MAX_PRODUCERS	64
+
+typedef struct producer {
+	pthread_t tid;
+	sched_t *sp;
+	task_t *tasks;
+	int ntasks;
+	bool fifo;
+	pthread_barrier_t *barrier;
+} producer_t;
+
+static void
+empty_func(void *arg, int thread_num)
+{
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void *
+producer_func(void *arg)
+{
+	int i;
+	producer_t *pp = arg;
+	bool ret;
+
+	(void) pthread_barrier_wait(pp->barrier);
+
+	for (i = 0; i < pp->ntasks; i++) {
+		task_init(&pp->tasks[i], SCHED_PRI_DEFAULT, empty_func, NULL);
+
+		/* If the queue is full, back off until the workers catch up. */
+		do {
+			if (pp->fifo)
+				ret = sched_post_fifo(pp->sp, &pp->tasks[i],
+				    true);
+			else
+				ret = sched_post(pp->sp, &pp->tasks[i], true);
+
+			if (!ret)
+				(void) usleep(1);
+		} while (!ret);
+	}
+
+	return (NULL);
+}
+
+static double
+run(int nproducers, bool fifo, task_t *tasks)
+{
+	int i;
+	double start, elapsed;
+	sched_t sched;
+	producer_t producers[MAX_PRODUCERS];
+	pthread_barrier_t barrier;
+
+	(void) sched_init(&sched, NWORKERS, QUEUE_DEPTH);
+	(void) pthread_barrier_init(&barrier, NULL, nproducers + 1);
+
+	for (i = 0; i < nproducers; i++) {
+		producers[i].sp = &sched;
+		producers[i].ntasks = POSTS / nproducers;
+		producers[i].tasks = tasks + i * (POSTS / nproducers);
+		producers[i].fifo = fifo;
+		producers[i].barrier = &barrier;
+		(void) pthread_create(&producers[i].tid, NULL, producer_func,
+		    &producers[i]);
+	}
+
+	(void) pthread_barrier_wait(&barrier);
+	start = now();
+
+	for (i = 0; i < nproducers; i++)
+		(void) pthread_join(producers[i].tid, NULL);
+
+	elapsed = now() - start;
+
+	sched_execute(&sched);
+	sched_fini(&sched);
+	(void) pthread_barrier_destroy(&barrier);
+
+	return ((POSTS / nproducers) * nproducers / elapsed);
+}
+
+int
+main(int argc, char **argv)
+{
+	int n;
+	task_t *tasks;
+
+	if ((tasks = malloc(sizeof (task_t) * POSTS)) == NULL) {
+		printf("Memory allocation failure.\n");
+		exit(-1);
+	}
+
+	printf("%-10s%15s%15s\n", "producers", "mutex/s", "fifo/s");
+
+	for (n = 1; n <= MAX_PRODUCERS; n *= 2) {
+		printf("%-10d%15.0f%15.0f\n", n, run(n, false, tasks),
+		    run(n, true, tasks));
+	}
+
+	free(tasks);
+	return (0);
+}
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sched.h>
+
+/*
+ * Keeps the workers saturated with urgent foreground tasks for a while, with a
+ * backlog of low-priority background tasks queued behind them, and counts how
+ * many background tasks get to run before the foreground load lets up.  Each
+ * foreground task posts itself again when it is done, so there is always more
+ * foreground work waiting than the workers can get to.  Under the priority
+ * policy the background tasks starve.  Under QoS they make progress either by
+ * aging alone, with every task in the default class, or by their class's share
+ * of each round.
+ */
+
+#define	NFOREGROUND	64
+#define	NBACKGROUND	32768
+#define	COST_NS		5000
+#define	LOAD_NS		500000000ULL
+
+/* Foreground and background priorities, lower being more urgent. */
+#define	FG_PRI		0
+#define	BG_PRI		100
+
+typedef enum run_kind {
+	RUN_PRIORITY,
+	RUN_AGING,
+	RUN_CLASSES
+} run_kind_t;
+
+static const char *run_names[] = { "priority", "qos aging", "qos classes" };
+
+static sched_t sched;
+static run_kind_t kind;
+static uint64_t load_end;
+static atomic_ulong fg_ran, bg_ran;
+static task_t fg_tasks[NFOREGROUND];
+static task_t bg_tasks[NBACKGROUND];
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+static void
+spin(void)
+{
+	uint64_t until = now_ns() + COST_NS;
+
+	while (now_ns() < until)
+		continue;
+}
+
+static void
+fg_post(task_t *tp);
+
+static void
+fg_func(void *arg, int thread_num)
+{
+	spin();
+	(void) atomic_fetch_add(&fg_ran, 1);
+
+	if (now_ns() < load_end)
+		fg_post(arg);
+}
+
+static void
+fg_post(task_t *tp)
+{
+	task_init(tp, FG_PRI, fg_func, tp);
+	tp->flags |= TASK_DETACHED;
+
+	if (kind == RUN_CLASSES)
+		task_set_qos(tp, SCHED_QOS_USER_INTERACTIVE);
+
+	(void) sched_post(&sched, tp, true);
+}
+
+static void
+bg_func(void *arg, int thread_num)
+{
+	spin();
+
+	if (now_ns() < load_end)
+		(void) atomic_fetch_add(&bg_ran, 1);
+}
+
+static void
+run(void)
+{
+	sched_attr_t attr;
+	int nworkers, i;
+
+	if ((nworkers = (int)sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		nworkers = 1;
+
+	sched_attr_init(&attr, nworkers, NFOREGROUND + NBACKGROUND);
+
+	if (kind != RUN_PRIORITY)
+		attr.policy = SCHED_POLICY_QOS;
+
+	(void) sched_init_attr(&sched, &attr);
+	atomic_store(&fg_ran, 0);
+	atomic_store(&bg_ran, 0);
+
+	for (i = 0; i < NBACKGROUND; i++) {
+		task_init(&bg_tasks[i], BG_PRI, bg_func, NULL);
+
+		if (kind == RUN_CLASSES)
+			task_set_qos(&bg_tasks[i], SCHED_QOS_BACKGROUND);
+
+		(void) sched_post(&sched, &bg_tasks[i], false);
+	}
+
+	load_end = now_ns() + LOAD_NS;
+
+	for (i = 0; i < NFOREGROUND; i++)
+		fg_post(&fg_tasks[i]);
+
+	sched_execute(&sched);
+	sched_fini(&sched);
+}
+
+int
+main(int argc, char **argv)
+{
+	printf("%-14s%12s%12s%12s\n", "policy", "foreground", "background",
+	    "bg share %");
+
+	for (kind = RUN_PRIORITY; kind <= RUN_CLASSES; kind++) {
+		run();
+		printf("%-14s%12lu%12lu%11.1f%%\n", run_names[kind],
+		    atomic_load(&fg_ran), atomic_load(&bg_ran),
+		    100.0 * atomic_load(&bg_ran) /
+		    (atomic_load(&fg_ran) + atomic_load(&bg_ran)));
+	}
+
+	return (0);
+}
@@ -0,0 +1,381 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <assert.h>
+#include <sched.h>
+
+/*
+ * The scheduler's regression suite.  Each benchmark is run with every worker
+ * count from 1 up to the number of online CPUs, REPS times per count, and the
+ * median run is reported.  Problem sizes are fixed so that results can be
+ * compared from one build to the next.  Results go to stdout and to
+ * <prefix>.csv and <prefix>.json, where the prefix defaults to "sched_bench".
+ *
+ *	throughput	Empty tasks posted in one batch; tasks/s.
+ *	latency		Post-to-start time of tasks posted in small bursts.
+ *	fanout		A task that posts FANOUT children and a join task that
+ *			waits on all of them; rounds/s.
+ *	inversion	Post-to-start time of urgent tasks posted while the
+ *			queue is full of less urgent work.
+ *	mixed		Half CPU-bound and half blocking tasks on an elastic
+ *			pool; tasks/s.
+ */
+
+#define	REPS		3
+#define	MAX_SAMPLES	(1 << 16)
+
+#define	THROUGHPUT_TASKS	(1 << 16)
+#define	LATENCY_TASKS		(1 << 12)
+#define	LATENCY_BURST		4
+#define	LATENCY_GAP_NS		50000
+#define	FANOUT			64
+#define	FANOUT_ROUNDS		256
+#define	INVERSION_FILLER	2048
+#define	INVERSION_PROBES	256
+#define	INVERSION_PRI_LOW	100
+#define	INVERSION_PRI_HIGH	0
+#define	MIXED_TASKS		512
+#define	MIXED_CPU_NS		50000
+#define	MIXED_IO_US		200
+
+typedef struct result {
+	double rate;		/* Operations per second, or 0. */
+	double p50;		/* Latencies in microseconds, or 0. */
+	double p99;
+} result_t;
+
+typedef struct sample {
+	task_t task;
+	uint64_t posted;
+	uint64_t started;
+} sample_t;
+
+typedef struct fanout {
+	sched_t *sp;
+	task_t root;
+	task_t join;
+	task_t children[FANOUT];
+	task_t *deps[FANOUT];
+} fanout_t;
+
+static sample_t samples[MAX_SAMPLES];
+static uint64_t lat[MAX_SAMPLES];
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+static void
+spin_ns(uint64_t ns)
+{
+	uint64_t until = now_ns() + ns;
+
+	while (now_ns() < until)
+		continue;
+}
+
+static int
+compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+/*
+ * Each benchmark measures either a rate or latencies, never both, so runs are
+ * ordered by whichever it was.
+ */
+static int
+compare_result(const void *a, const void *b)
+{
+	const result_t *x = a;
+	const result_t *y = b;
+
+	if (x->rate != y->rate)
+		return (x->rate < y->rate ? -1 : 1);
+
+	return (x->p50 < y->p50 ? -1 : x->p50 > y->p50);
+}
+
+/*
+ * Fill in the latency percentiles from the first `n' samples.
+ */
+static void
+percentiles(int n, result_t *rp)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		lat[i] = samples[i].started - samples[i].posted;
+
+	qsort(lat, n, sizeof (uint64_t), compare_u64);
+	rp->p50 = lat[n / 2] / 1e3;
+	rp->p99 = lat[n * 99 / 100] / 1e3;
+}
+
+static void
+empty_func(void *arg, int thread_num)
+{
+}
+
+static void
+start_func(void *arg, int thread_num)
+{
+	sample_t *smp = arg;
+
+	smp->started = now_ns();
+}
+
+static void
+throughput(int nworkers, result_t *rp)
+{
+	static task_t tasks[THROUGHPUT_TASKS];
+	static task_t *batch[THROUGHPUT_TASKS];
+	sched_t sched;
+	uint64_t start;
+	int i;
+
+	(void) sched_init(&sched, nworkers, THROUGHPUT_TASKS);
+
+	for (i = 0; i < THROUGHPUT_TASKS; i++) {
+		task_init(&tasks[i], SCHED_PRI_DEFAULT, empty_func, NULL);
+		batch[i] = &tasks[i];
+	}
+
+	start = now_ns();
+	(void) sched_post_batch(&sched, batch, THROUGHPUT_TASKS, false);
+	sched_execute(&sched);
+	rp->rate = THROUGHPUT_TASKS / ((now_ns() - start) / 1e9);
+
+	sched_fini(&sched);
+}
+
+static void
+latency(int nworkers, result_t *rp)
+{
+	sched_t sched;
+	int i;
+
+	(void) sched_init(&sched, nworkers, LATENCY_TASKS);
+
+	for (i = 0; i < LATENCY_TASKS; i++) {
+		task_init(&samples[i].task, SCHED_PRI_DEFAULT, start_func,
+		    &samples[i]);
+		samples[i].posted = now_ns();
+		(void) sched_post(&sched, &samples[i].task, true);
+
+		if (i % LATENCY_BURST == LATENCY_BURST - 1)
+			spin_ns(LATENCY_GAP_NS);
+	}
+
+	sched_execute(&sched);
+	sched_fini(&sched);
+	percentiles(LATENCY_TASKS, rp);
+}
+
+static void
+fanout_root(void *arg, int thread_num)
+{
+	fanout_t *fp = arg;
+	int i;
+
+	for (i = 0; i < FANOUT; i++) {
+		task_init(&fp->children[i], SCHED_PRI_DEFAULT, empty_func,
+		    NULL);
+		fp->deps[i] = &fp->children[i];
+	}
+
+	/* The join has to be hooked up before any child can finish. */
+	task_init(&fp->join, SCHED_PRI_DEFAULT, empty_func, NULL);
+	(void) sched_post_after(fp->sp, &fp->join, fp->deps, FANOUT,
+	    true);
+	(void) sched_post_batch(fp->sp, fp->deps, FANOUT, true);
+}
+
+static void
+fanout(int nworkers, result_t *rp)
+{
+	static fanout_t fo;
+	sched_t sched;
+	uint64_t start;
+	int i;
+
+	(void) sched_init_mode(&sched, nworkers, FANOUT * 2,
+	    SCHED_MODE_STEAL);
+	fo.sp = &sched;
+
+	start = now_ns();
+
+	for (i = 0; i < FANOUT_ROUNDS; i++) {
+		task_init(&fo.root, SCHED_PRI_DEFAULT, fanout_root, &fo);
+		(void) sched_post(&sched, &fo.root, false);
+		sched_execute(&sched);
+	}
+
+	rp->rate = FANOUT_ROUNDS / ((now_ns() - start) / 1e9);
+	sched_fini(&sched);
+}
+
+static void
+filler_func(void *arg, int thread_num)
+{
+	spin_ns(MIXED_CPU_NS / 10);
+}
+
+/*
+ * With a backlog of less urgent work queued, an urgent task should only ever
+ * wait for a worker to finish whatever it is running, not for the backlog.
+ */
+static void
+inversion(int nworkers, result_t *rp)
+{
+	static task_t filler[INVERSION_FILLER];
+	sched_t sched;
+	int i, j = 0;
+
+	(void) sched_init(&sched, nworkers,
+	    INVERSION_FILLER + INVERSION_PROBES);
+
+	for (i = 0; i < INVERSION_FILLER; i++) {
+		task_init(&filler[i], INVERSION_PRI_LOW, filler_func, NULL);
+		(void) sched_post(&sched, &filler[i], true);
+
+		if (i % (INVERSION_FILLER / INVERSION_PROBES) == 0) {
+			task_init(&samples[j].task, INVERSION_PRI_HIGH,
+			    start_func, &samples[j]);
+			samples[j].posted = now_ns();
+			(void) sched_post(&sched, &samples[j].task, true);
+			j++;
+		}
+	}
+
+	sched_execute(&sched);
+	sched_fini(&sched);
+	percentiles(j, rp);
+}
+
+static void
+mixed_func(void *arg, int thread_num)
+{
+	if ((intptr_t)arg % 2 == 0) {
+		spin_ns(MIXED_CPU_NS);
+		return;
+	}
+
+	sched_block_begin();
+	(void) usleep(MIXED_IO_US);
+	sched_block_end();
+}
+
+static void
+mixed(int nworkers, result_t *rp)
+{
+	static task_t tasks[MIXED_TASKS];
+	static task_t *batch[MIXED_TASKS];
+	sched_t sched;
+	sched_attr_t attr;
+	uint64_t start;
+	int i;
+
+	sched_attr_init(&attr, nworkers, MIXED_TASKS);
+	attr.max_workers = nworkers * 2;
+	(void) sched_init_attr(&sched, &attr);
+
+	for (i = 0; i < MIXED_TASKS; i++) {
+		task_init(&tasks[i], SCHED_PRI_DEFAULT, mixed_func,
+		    (void *)(intptr_t)i);
+		batch[i] = &tasks[i];
+	}
+
+	start = now_ns();
+	(void) sched_post_batch(&sched, batch, MIXED_TASKS, false);
+	sched_execute(&sched);
+	rp->rate = MIXED_TASKS / ((now_ns() - start) / 1e9);
+
+	sched_fini(&sched);
+}
+
+typedef struct benchmark {
+	const char *name;
+	void (*run)(int, result_t *);
+} benchmark_t;
+
+static benchmark_t benchmarks[] = {
+	{ "throughput", throughput },
+	{ "latency", latency },
+	{ "fanout", fanout },
+	{ "inversion", inversion },
+	{ "mixed", mixed }
+};
+
+#define	NBENCHMARKS	(sizeof (benchmarks) / sizeof (benchmarks[0]))
+
+int
+main(int argc, char **argv)
+{
+	const char *prefix = argc > 1 ? argv[1] : "sched_bench";
+	char path[256];
+	FILE *csv, *json;
+	result_t runs[REPS], *rp;
+	int ncpus, b, n, r;
+	bool first = true;
+
+	if ((ncpus = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		ncpus = 1;
+
+	(void) snprintf(path, sizeof (path), "%s.csv", prefix);
+
+	if ((csv = fopen(path, "w")) == NULL) {
+		printf("Failed to open file: %s\n", path);
+		exit(1);
+	}
+
+	(void) snprintf(path, sizeof (path), "%s.json", prefix);
+
+	if ((json = fopen(path, "w")) == NULL) {
+		printf("Failed to open file: %s\n", path);
+		exit(1);
+	}
+
+	(void) fprintf(csv, "benchmark,workers,ops_per_sec,p50_us,p99_us\n");
+	(void) fprintf(json, "[");
+	printf("%-12s%8s%16s%12s%12s\n", "benchmark", "workers", "ops/s",
+	    "p50 (us)", "p99 (us)");
+
+	for (b = 0; b < NBENCHMARKS; b++) {
+		for (n = 1; n <= ncpus; n++) {
+			for (r = 0; r < REPS; r++) {
+				bzero(&runs[r], sizeof (result_t));
+				benchmarks[b].run(n, &runs[r]);
+			}
+
+			qsort(runs, REPS, sizeof (result_t), compare_result);
+			rp = &runs[REPS / 2];
+
+			printf("%-12s%8d%16.0f%12.1f%12.1f\n",
+			    benchmarks[b].name, n, rp->rate, rp->p50, rp->p99);
+			(void) fprintf(csv, "%s,%d,%.0f,%.3f,%.3f\n",
+			    benchmarks[b].name, n, rp->rate, rp->p50, rp->p99);
+			(void) fprintf(json, "%s\n  {\"benchmark\": \"%s\", "
+			    "\"workers\": %d, \"ops_per_sec\": %.0f, "
+			    "\"p50_us\": %.3f, \"p99_us\": %.3f}",
+			    first ? "" : ",", benchmarks[b].name, n, rp->rate,
+			    rp->p50, rp->p99);
+			first = false;
+		}
+	}
+
+	(void) fprintf(json, "\n]\n");
+	(void) fclose(csv);
+	(void) fclose(json);
+	return (0);
+}
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <assert.h>
+#include <sched.h>
+
+/*
+ * Measures what a short-lived program pays to bring a scheduler up, run a
+ * little work and tear it down again, as hello and sudoku do.  A scheduler
+ * that starts every worker up front is compared with a lazy one, which only
+ * starts workers once tasks back up and otherwise runs them on the thread that
+ * calls sched_execute(), and with a lazy one whose workers get small stacks.
+ * Each case reports the median time of a round and how many workers it
+ * started.  The work is either a flat batch of tasks, or a single task that
+ * spawns a binary tree of them with sched_spawn() and sched_sync(), in which
+ * the caller of sched_execute() ends up waiting on tasks that a lazy
+ * scheduler has yet to start a worker for.
+ */
+
+#define	NWORKERS	16
+#define	REPS		201
+#define	STACK_SIZE	(64 * 1024)
+
+/* Start a worker for every this many tasks outstanding; see sched.h. */
+#define	LAZY		32
+
+/* Busy-work per task, in ns. */
+#define	TASK_NS		2000
+
+typedef enum start_kind {
+	START_EAGER,
+	START_LAZY,
+	START_LAZY_SMALL
+} start_kind_t;
+
+static const char *start_names[] = { "eager", "lazy", "lazy+stack" };
+
+static const int task_counts[] = { 1, 16, 256, 4096 };
+
+/* Fork-join trees of about the same sizes: 2^(depth + 1) - 1 tasks. */
+static const int tree_depths[] = { 0, 3, 7, 11 };
+
+typedef struct tree_node {
+	sched_t *sched;
+	int depth;
+} tree_node_t;
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+static void
+work_func(void *arg, int thread_num)
+{
+	uint64_t until = now_ns() + TASK_NS;
+
+	while (now_ns() < until)
+		continue;
+}
+
+static void
+tree_func(void *arg, int thread_num)
+{
+	tree_node_t *np = arg;
+	tree_node_t kids[2];
+	task_t tasks[2];
+	sched_group_t group;
+	int i;
+
+	work_func(NULL, thread_num);
+
+	if (np->depth == 0)
+		return;
+
+	sched_group_init(&group);
+
+	for (i = 0; i < 2; i++) {
+		kids[i].sched = np->sched;
+		kids[i].depth = np->depth - 1;
+		task_init(&tasks[i], SCHED_PRI_DEFAULT, tree_func, &kids[i]);
+		sched_spawn(np->sched, &group, &tasks[i]);
+	}
+
+	sched_sync(np->sched, &group);
+	sched_group_destroy(&group);
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+/*
+ * One round: `ntasks' flat tasks, or if `depth' is not negative, a tree of
+ * that depth.
+ */
+static uint64_t
+run(start_kind_t kind, task_t *tasks, int ntasks, int depth, int *threads)
+{
+	sched_t sched;
+	sched_attr_t attr;
+	tree_node_t root;
+	uint64_t start;
+	int i;
+
+	start = now_ns();
+
+	sched_attr_init(&attr, NWORKERS, ntasks);
+
+	if (kind != START_EAGER)
+		attr.lazy = LAZY;
+
+	if (kind == START_LAZY_SMALL)
+		attr.stack_size = STACK_SIZE;
+
+	if (!sched_init_attr(&sched, &attr)) {
+		(void) fprintf(stderr, "sched_init_attr failed\n");
+		exit(1);
+	}
+
+	if (depth >= 0) {
+		root.sched = &sched;
+		root.depth = depth;
+		task_init(&tasks[0], SCHED_PRI_DEFAULT, tree_func, &root);
+		(void) sched_post(&sched, &tasks[0], false);
+	} else {
+		for (i = 0; i < ntasks; i++) {
+			task_init(&tasks[i], SCHED_PRI_DEFAULT, work_func,
+			    NULL);
+			(void) sched_post(&sched, &tasks[i], false);
+		}
+	}
+
+	sched_execute(&sched);
+	*threads = atomic_load(&sched.live_workers);
+	sched_fini(&sched);
+
+	return (now_ns() - start);
+}
+
+int
+main(int argc, char **argv)
+{
+	uint64_t times[REPS];
+	task_t *tasks;
+	start_kind_t kind;
+	int i, r, ntasks, depth, shape, threads;
+
+	if ((tasks = malloc(sizeof (task_t) *
+	    task_counts[sizeof (task_counts) / sizeof (int) - 1])) == NULL)
+		return (1);
+
+	printf("%-8s%-10s%-12s%12s%10s\n", "tasks", "shape", "start",
+	    "median us", "threads");
+
+	for (i = 0; i < sizeof (task_counts) / sizeof (int); i++) {
+		for (shape = 0; shape < 2; shape++) {
+			depth = shape == 0 ? -1 : tree_depths[i];
+			ntasks = shape == 0 ? task_counts[i] :
+			    (2 << depth) - 1;
+
+			for (kind = START_EAGER; kind <= START_LAZY_SMALL;
+			    kind++) {
+				for (r = 0; r < REPS; r++) {
+					times[r] = run(kind, tasks, ntasks,
+					    depth, &threads);
+				}
+
+				qsort(times, REPS, sizeof (uint64_t), cmp_u64);
+				printf("%-8d%-10s%-12s%12.1f%10d\n", ntasks,
+				    shape == 0 ? "flat" : "fork-join",
+				    start_names[kind],
+				    times[REPS / 2] / 1000.0, threads);
+			}
+		}
+	}
+
+	free(tasks);
+	return (0);
+}
@@ -0,0 +1,295 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <assert.h>
+
+#include "sched.h"
+#include "sched_impl.h"
+
+
+/* Helpers are posted as one batch from an array on the stack. */
+#define	APPLY_MAX_HELPERS	256
+
+/*
+ * The shared state for one call to sched_apply_part().  Helper tasks may still
+ * be sitting in the queue after the caller has returned, so this is reference
+ * counted and released by whoever is last to let go of it, helper tasks
+ * included.
+ */
+typedef struct apply {
+	sched_t *sched;
+	size_t n;
+	size_t grain;
+	sched_partition_t part;
+	sched_apply_fn_t fn;
+	void *arg;
+	int participants;
+	atomic_size_t next;		/* Next iteration or block to claim. */
+	atomic_int refs;
+	sched_group_t inflight;		/* Chunks claimed but not finished. */
+	task_t helpers[];
+} apply_t;
+
+/*
+ * Claim the next chunk of iterations.  Returns false once there are none left.
+ */
+static bool
+apply_claim(apply_t *ap, size_t *beginp, size_t *endp)
+{
+	size_t cur, left, size;
+
+	switch (ap->part) {
+	case SCHED_PART_STATIC:
+		cur = atomic_fetch_add(&ap->next, 1);
+
+		if (cur >= ap->participants)
+			return (false);
+
+		*beginp = cur * ap->n / ap->participants;
+		*endp = (cur + 1) * ap->n / ap->participants;
+		return (true);
+	case SCHED_PART_GUIDED:
+		cur = atomic_load(&ap->next);
+
+		do {
+			if (cur >= ap->n)
+				return (false);
+
+			left = ap->n - cur;
+			size = left / (2 * ap->participants);
+			size = size < ap->grain ? ap->grain : size;
+			size = size > left ? left : size;
+		} while (!atomic_compare_exchange_weak(&ap->next, &cur,
+		    cur + size));
+
+		*beginp = cur;
+		*endp = cur + size;
+		return (true);
+	default:
+		cur = atomic_fetch_add(&ap->next, ap->grain);
+
+		if (cur >= ap->n)
+			return (false);
+
+		*beginp = cur;
+		*endp = cur + ap->grain > ap->n ? ap->n : cur + ap->grain;
+		return (true);
+	}
+}
+
+static void
+apply_release(apply_t *ap)
+{
+	if (atomic_fetch_sub(&ap->refs, 1) == 1) {
+		sched_group_destroy(&ap->inflight);
+		free(ap);
+	}
+}
+
+/*
+ * Each chunk is bracketed by entering and leaving `inflight', and the enter
+ * comes before the claim.  Once the claims have run dry, waiting for
+ * `inflight' to empty therefore covers every chunk that was handed out.
+ */
+static void
+apply_run(apply_t *ap, int worker)
+{
+	size_t begin, end;
+
+	for (;;) {
+		sched_group_enter(&ap->inflight);
+
+		if (!apply_claim(ap, &begin, &end)) {
+			sched_group_leave(&ap->inflight);
+			break;
+		}
+
+		ap->fn(ap->arg, begin, end, worker);
+		sched_group_leave(&ap->inflight);
+	}
+}
+
+/*
+ * The slot past the last worker belongs to the caller alone.  A helper that
+ * lands on some other thread that is not a worker, such as one running a lazy
+ * scheduler's tasks from within sched_execute(), would share it, so it leaves
+ * the work to the others.
+ */
+static void
+apply_helper(void *arg, int thread_num)
+{
+	apply_t *ap = arg;
+
+	if (thread_num >= 0 && thread_num < SCHED_HOST(ap->sched)->num_workers)
+		apply_run(ap, thread_num);
+
+	apply_release(ap);
+}
+
+void
+sched_apply(sched_t *sp, size_t n, size_t grain, sched_apply_fn_t fn,
+    void *arg)
+{
+	sched_apply_part(sp, n, grain, SCHED_PART_DYNAMIC, fn, arg);
+}
+
+/*
+ * Run `fn' over the range [0, n) in chunks, in parallel, like a parallel for
+ * loop.  No tasks are allocated per iteration: at most one helper task per
+ * worker is posted, and every participant pulls chunks from a shared counter
+ * until they run out.  The calling thread participates too, so the loop
+ * completes even if every worker is busy.  `fn' is handed the worker it is
+ * running on; when that is the calling thread and it is not one of our workers,
+ * it is handed `num_workers', so per-worker buffers need num_workers + 1 slots.
+ * For an attached scheduler, those are the pool's workers.  No other thread is
+ * handed `num_workers' by this call, but several threads that are not workers
+ * each calling this at once all are, so they need buffers of their own.
+ */
+void
+sched_apply_part(sched_t *sp, size_t n, size_t grain, sched_partition_t part,
+    sched_apply_fn_t fn, void *arg)
+{
+	apply_t *ap;
+	task_t *batch[APPLY_MAX_HELPERS];
+	size_t chunks;
+	int i, nhelpers, self, workers;
+
+	assert(sp != NULL && fn != NULL);
+
+	if (n == 0)
+		return;
+
+	if (grain == 0)
+		grain = 1;
+
+	/* Don't post helpers that could never find anything to do. */
+	chunks = (n + grain - 1) / grain;
+
+	/* A lazy scheduler starts its workers as the helpers queue up. */
+	if ((workers = atomic_load(&sp->live_workers)) < sp->min_workers)
+		workers = sp->min_workers;
+
+	if ((self = sched_current_worker()) < 0 ||
+	    sched_current() != SCHED_HOST(sp)) {
+		self = SCHED_HOST(sp)->num_workers;
+		nhelpers = workers;
+	} else {
+		nhelpers = workers - 1;
+	}
+
+	if (nhelpers > chunks - 1)
+		nhelpers = chunks - 1;
+
+	if (nhelpers > APPLY_MAX_HELPERS)
+		nhelpers = APPLY_MAX_HELPERS;
+
+	if ((ap = malloc(sizeof (apply_t) +
+	    sizeof (task_t) * nhelpers)) == NULL ||
+	    !sched_group_init(&ap->inflight)) {
+		/* We can't go parallel, but the loop still has to run. */
+		free(ap);
+		fn(arg, 0, n, self);
+		return;
+	}
+
+	ap->sched = sp;
+	ap->n = n;
+	ap->grain = grain;
+	ap->part = part;
+	ap->fn = fn;
+	ap->arg = arg;
+	ap->participants = nhelpers + 1;
+	atomic_init(&ap->next, 0);
+	atomic_init(&ap->refs, nhelpers + 1);
+
+	for (i = 0; i < nhelpers; i++) {
+		task_init(&ap->helpers[i], SCHED_PRI_DEFAULT, apply_helper, ap);
+		ap->helpers[i].flags |= TASK_DETACHED;
+		batch[i] = &ap->helpers[i];
+	}
+
+	/*
+	 * If the helpers can't be queued, they simply never show up and we
+	 * do all of the work ourselves.
+	 */
+	if (nhelpers > 0 && !sched_post_batch(sp, batch, nhelpers, true))
+		(void) atomic_fetch_sub(&ap->refs, nhelpers);
+
+	apply_run(ap, self);
+	sched_group_wait(&ap->inflight);
+	apply_release(ap);
+}
+
+/*
+ * The state for one call to sched_reduce().  There is an accumulator for each
+ * slot that sched_apply_part() may hand its function, each starting a cache
+ * line of its own so that workers never write to the same line.  The last is
+ * the caller's own, whether or not it is a worker.
+ */
+typedef struct reduce {
+	sched_map_fn_t map;
+	void *arg;
+	size_t stride;
+	unsigned char *accs;
+} reduce_t;
+
+static void
+reduce_chunk(void *arg, size_t begin, size_t end, int worker)
+{
+	reduce_t *rp = arg;
+
+	rp->map(rp->arg, begin, end, rp->accs + rp->stride * worker, worker);
+}
+
+/*
+ * A parallel reduction over [0, n): `map' folds chunks of about `grain'
+ * iterations in to the running accumulator of whichever worker runs them, and
+ * the accumulators are then combined pairwise, as a tree, in to `result'.
+ * Accumulators are `size' bytes and start out as copies of `identity'.  Since
+ * each worker only ever touches its own, neither `map' nor `combine' needs any
+ * locking.  The order in which chunks are combined is not defined, so
+ * `combine' should be associative and commutative.
+ */
+void
+sched_reduce(sched_t *sp, size_t n, size_t grain, sched_map_fn_t map,
+    sched_combine_fn_t combine, const void *identity, void *result,
+    size_t size, void *arg)
+{
+	reduce_t r;
+	int i, step, slots;
+
+	assert(sp != NULL && map != NULL && combine != NULL &&
+	    identity != NULL && result != NULL);
+
+	/* One slot per worker, plus one for a caller that isn't a worker. */
+	slots = SCHED_HOST(sp)->num_workers + 1;
+	r.map = map;
+	r.arg = arg;
+	r.stride = (size + SCHED_CACHE_LINE - 1) & ~(SCHED_CACHE_LINE - 1);
+
+	if (r.stride == 0 ||
+	    (r.accs = aligned_alloc(SCHED_CACHE_LINE, r.stride * slots)) ==
+	    NULL) {
+		(void) memcpy(result, identity, size);
+		map(arg, 0, n, result, sched_current() == SCHED_HOST(sp) ?
+		    sched_current_worker() : SCHED_HOST(sp)->num_workers);
+		return;
+	}
+
+	for (i = 0; i < slots; i++)
+		(void) memcpy(r.accs + r.stride * i, identity, size);
+
+	sched_apply(sp, n, grain, reduce_chunk, &r);
+
+	for (step = 1; step < slots; step *= 2) {
+		for (i = 0; i + step < slots; i += 2 * step)
+			combine(arg, r.accs + r.stride * i,
+			    r.accs + r.stride * (i + step));
+	}
+
+	(void) memcpy(result, r.accs, size);
+	free(r.accs);
+}
@@ -0,0 +1,221 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "sched.h"
+#include "sched_impl.h"
+
+
+/*
+ * Slots are allocated this many at a time.  A worker keeps up to
+ * ASYNC_CACHE_MAX free slots to itself, and trades them with the shared list
+ * ASYNC_CACHE_MOVE at a time, so that the lock is only taken once every so
+ * many posts.
+ */
+#define	ASYNC_SLAB		64
+#define	ASYNC_CACHE_MAX		64
+#define	ASYNC_CACHE_MOVE	(ASYNC_CACHE_MAX / 2)
+
+typedef struct sched_async_slab {
+	struct sched_async_slab *next;
+	sched_async_t slots[ASYNC_SLAB];
+} sched_async_slab_t;
+
+bool
+sched_async_init(sched_t *sp)
+{
+	sched_async_pool_t *app = &sp->async;
+
+	app->free = NULL;
+	app->slabs = NULL;
+
+	return (pthread_mutex_init(&app->lock, NULL) == 0);
+}
+
+/*
+ * The workers are gone by now, so their caches go along with the slabs.
+ */
+void
+sched_async_fini(sched_t *sp)
+{
+	sched_async_pool_t *app = &sp->async;
+	sched_async_slab_t *slab, *next;
+
+	for (slab = app->slabs; slab != NULL; slab = next) {
+		next = slab->next;
+		free(slab);
+	}
+
+	(void) pthread_mutex_destroy(&app->lock);
+}
+
+/*
+ * The calling thread's worker, if it is one of `sp's.
+ */
+static worker_t *
+async_worker(sched_t *sp)
+{
+	if (sched_current() != sp)
+		return (NULL);
+
+	return (&sp->workers[sched_current_worker()]);
+}
+
+/*
+ * Add a slab's worth of slots to the shared list.  Must be called with
+ * `async.lock' held.
+ */
+static bool
+async_grow(sched_async_pool_t *app)
+{
+	sched_async_slab_t *slab;
+	int i;
+
+	if ((slab = malloc(sizeof (sched_async_slab_t))) == NULL)
+		return (false);
+
+	for (i = 0; i < ASYNC_SLAB; i++) {
+		slab->slots[i].next = app->free;
+		app->free = &slab->slots[i];
+	}
+
+	slab->next = app->slabs;
+	app->slabs = slab;
+	return (true);
+}
+
+/*
+ * Take a free slot, preferably from the calling worker's cache.  A worker that
+ * has run dry refills its cache from the shared list while it holds the lock.
+ */
+static sched_async_t *
+async_alloc(sched_t *sp, worker_t *wp)
+{
+	sched_async_pool_t *app = &sp->async;
+	sched_async_t *slot, *next;
+
+	if (wp != NULL && (slot = wp->async_free) != NULL) {
+		wp->async_free = slot->next;
+		wp->async_cached--;
+		return (slot);
+	}
+
+	(void) pthread_mutex_lock(&app->lock);
+
+	if (app->free == NULL && !async_grow(app)) {
+		(void) pthread_mutex_unlock(&app->lock);
+		return (NULL);
+	}
+
+	slot = app->free;
+	app->free = slot->next;
+
+	while (wp != NULL && wp->async_cached < ASYNC_CACHE_MOVE &&
+	    (next = app->free) != NULL) {
+		app->free = next->next;
+		next->next = wp->async_free;
+		wp->async_free = next;
+		wp->async_cached++;
+	}
+
+	(void) pthread_mutex_unlock(&app->lock);
+	return (slot);
+}
+
+/*
+ * Give a slot back.  Slots tend to be taken by the threads that post and
+ * freed by the workers that run them, so a worker whose cache overflows hands
+ * part of it back to the shared list for the posters to use.
+ */
+static void
+async_release(sched_t *sp, worker_t *wp, sched_async_t *slot)
+{
+	sched_async_pool_t *app = &sp->async;
+	sched_async_t *head, *tail;
+	int i;
+
+	if (wp == NULL) {
+		(void) pthread_mutex_lock(&app->lock);
+		slot->next = app->free;
+		app->free = slot;
+		(void) pthread_mutex_unlock(&app->lock);
+		return;
+	}
+
+	slot->next = wp->async_free;
+	wp->async_free = slot;
+
+	if (++wp->async_cached <= ASYNC_CACHE_MAX)
+		return;
+
+	head = tail = wp->async_free;
+
+	for (i = 1; i < ASYNC_CACHE_MOVE; i++)
+		tail = tail->next;
+
+	wp->async_free = tail->next;
+	wp->async_cached -= ASYNC_CACHE_MOVE;
+
+	(void) pthread_mutex_lock(&app->lock);
+	tail->next = app->free;
+	app->free = head;
+	(void) pthread_mutex_unlock(&app->lock);
+}
+
+/*
+ * The slot's task is detached, so it can be recycled as soon as the closure
+ * has run.
+ */
+static void
+async_run(void *arg, int thread_num)
+{
+	sched_async_t *slot = arg;
+	sched_t *sp = slot->sched;
+
+	slot->fn(slot->closure, thread_num);
+	async_release(sp, async_worker(sp), slot);
+}
+
+/*
+ * Run `fn' at priority `pri' as soon as a worker is free.  The `len' bytes at
+ * `closure' are copied in to a task owned by the scheduler, and `fn' is handed
+ * a pointer to the copy, so the caller has nothing to keep alive.  Tasks come
+ * from a pool that is recycled as they finish, so once it has warmed up,
+ * posting allocates nothing.  Fails if the closure is larger than
+ * SCHED_ASYNC_INLINE, the queue is full, or the pool cannot grow.
+ */
+bool
+sched_async(sched_t *sp, uint64_t pri, sched_async_fn_t fn,
+    const void *closure, size_t len)
+{
+	sched_async_t *slot;
+	worker_t *wp;
+
+	assert(sp != NULL && fn != NULL && (closure != NULL || len == 0));
+
+	if (len > SCHED_ASYNC_INLINE)
+		return (false);
+
+	wp = async_worker(sp);
+
+	if ((slot = async_alloc(sp, wp)) == NULL)
+		return (false);
+
+	task_init(&slot->task, pri, async_run, slot);
+	slot->task.flags |= TASK_DETACHED;
+	slot->sched = sp;
+	slot->fn = fn;
+
+	if (len > 0)
+		(void) memcpy(slot->closure, closure, len);
+
+	if (!sched_post(sp, &slot->task, true)) {
+		async_release(sp, wp, slot);
+		return (false);
+	}
+
+	return (true);
+}
@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <assert.h>
+
+#include "deque.h"
+
+
+static deque_array_t *
+deque_array_create(int64_t size)
+{
+	deque_array_t *ap;
+
+	if ((ap = malloc(sizeof (deque_array_t) +
+	    sizeof (_Atomic(void *)) * size)) == NULL)
+		return (NULL);
+
+	(void) bzero(ap, sizeof (deque_array_t) +
+	    sizeof (_Atomic(void *)) * size);
+	ap->size = size;
+	return (ap);
+}
+
+bool
+deque_init(deque_t *dp, int capacity)
+{
+	int64_t size = 1;
+	deque_array_t *ap;
+
+	assert(dp != NULL);
+
+	/* The array is indexed with a mask, so round up to a power of two. */
+	while (size < capacity)
+		size <<= 1;
+
+	if ((ap = deque_array_create(size)) == NULL)
+		return (false);
+
+	atomic_init(&dp->top, 0);
+	atomic_init(&dp->bottom, 0);
+	atomic_init(&dp->array, ap);
+	return (true);
+}
+
+void
+deque_destroy(deque_t *dp)
+{
+	deque_array_t *ap, *prev;
+
+	assert(dp != NULL);
+
+	for (ap = atomic_load(&dp->array); ap != NULL; ap = prev) {
+		prev = ap->prev;
+		free(ap);
+	}
+}
+
+/*
+ * Double the size of the array.  Thieves may still be reading from the old
+ * array, so rather than freeing it we chain it off of the new one and release
+ * everything when the deque is destroyed.
+ */
+static deque_array_t *
+deque_grow(deque_t *dp, deque_array_t *ap, int64_t top, int64_t bottom)
+{
+	int64_t i;
+	deque_array_t *newap;
+
+	if ((newap = deque_array_create(ap->size * 2)) == NULL)
+		return (NULL);
+
+	for (i = top; i < bottom; i++) {
+		atomic_store_explicit(&newap->buf[i & (newap->size - 1)],
+		    atomic_load_explicit(&ap->buf[i & (ap->size - 1)],
+		    memory_order_relaxed), memory_order_relaxed);
+	}
+
+	newap->prev = ap;
+	atomic_store_explicit(&dp->array, newap, memory_order_release);
+	return (newap);
+}
+
+bool
+deque_push(deque_t *dp, void *item)
+{
+	int64_t top, bottom;
+	deque_array_t *ap;
+
+	assert(dp != NULL && item != NULL);
+
+	bottom = atomic_load_explicit(&dp->bottom, memory_order_relaxed);
+	top = atomic_load_explicit(&dp->top, memory_order_acquire);
+	ap = atomic_load_explicit(&dp->array, memory_order_relaxed);
+
+	if (bottom - top > ap->size - 1 &&
+	    (ap = deque_grow(dp, ap, top, bottom)) == NULL)
+		return (false);
+
+	atomic_store_explicit(&ap->buf[bottom & (ap->size - 1)], item,
+	    memory_order_relaxed);
+	atomic_store_explicit(&dp->bottom, bottom + 1, memory_order_release);
+	return (true);
+}
+
+void *
+deque_take(deque_t *dp)
+{
+	int64_t top, bottom;
+	deque_array_t *ap;
+	void *item = NULL;
+
+	assert(dp != NULL);
+
+	bottom = atomic_load_explicit(&dp->bottom, memory_order_relaxed) - 1;
+	ap = atomic_load_explicit(&dp->array, memory_order_relaxed);
+	atomic_store_explicit(&dp->bottom, bottom, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	top = atomic_load_explicit(&dp->top, memory_order_relaxed);
+
+	if (top > bottom) {
+		/* The deque was already empty. */
+		atomic_store_explicit(&dp->bottom, bottom + 1,
+		    memory_order_relaxed);
+		return (NULL);
+	}
+
+	item = atomic_load_explicit(&ap->buf[bottom & (ap->size - 1)],
+	    memory_order_relaxed);
+
+	if (top == bottom) {
+		/*
+		 * This is the last item, so we are racing any thieves for it.
+		 * Whoever advances `top' first wins.
+		 */
+		if (!atomic_compare_exchange_strong_explicit(&dp->top, &top,
+		    top + 1, memory_order_seq_cst, memory_order_relaxed))
+			item = NULL;
+
+		atomic_store_explicit(&dp->bottom, bottom + 1,
+		    memory_order_relaxed);
+	}
+
+	return (item);
+}
+
+/*
+ * Returns NULL if the deque is empty _or_ if we lost a race with another
+ * thread.  Callers are expected to simply move on to another victim.
+ */
+void *
+deque_steal(deque_t *dp)
+{
+	int64_t top, bottom;
+	deque_array_t *ap;
+	void *item;
+
+	assert(dp != NULL);
+
+	top = atomic_load_explicit(&dp->top, memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	bottom = atomic_load_explicit(&dp->bottom, memory_order_acquire);
+
+	if (top >= bottom)
+		return (NULL);
+
+	ap = atomic_load_explicit(&dp->array, memory_order_acquire);
+	item = atomic_load_explicit(&ap->buf[top & (ap->size - 1)],
+	    memory_order_relaxed);
+
+	if (!atomic_compare_exchange_strong_explicit(&dp->top, &top, top + 1,
+	    memory_order_seq_cst, memory_order_relaxed))
+		return (NULL);
+
+	return (item);
+}
+
+bool
+deque_empty(deque_t *dp)
+{
+	assert(dp != NULL);
+
+	return (atomic_load(&dp->bottom) <= atomic_load(&dp->top));
+}
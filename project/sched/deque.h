@@ -0,0 +1,34 @@
+#ifndef	_DEQUE_H
+#define	_DEQUE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <assert.h>
+
+/*
+ * A Chase-Lev work-stealing deque.  The owning thread pushes and takes from
+ * the bottom without taking any locks, while any number of other threads may
+ * steal from the top.  Only the owner may call deque_push() and deque_take().
+ */
+typedef struct deque_array {
+	int64_t size;			/* Always a power of two. */
+	struct deque_array *prev;	/* Retired array, freed on destroy. */
+	_Atomic(void *) buf[];
+} deque_array_t;
+
+typedef struct deque {
+	_Atomic int64_t top;
+	_Atomic int64_t bottom;
+	_Atomic(deque_array_t *) array;
+} deque_t;
+
+bool deque_init(deque_t *, int);
+void deque_destroy(deque_t *);
+bool deque_push(deque_t *, void *);
+void *deque_take(deque_t *);
+void *deque_steal(deque_t *);
+bool deque_empty(deque_t *);
+
+#endif	/* _DEQUE_H */
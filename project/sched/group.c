@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <assert.h>
+
+#include "sched.h"
+#include "sched_impl.h"
+
+
+bool
+sched_group_init(sched_group_t *gp)
+{
+	assert(gp != NULL);
+
+	bzero(gp, sizeof (sched_group_t));
+
+	if (pthread_mutex_init(&gp->lock, NULL) != 0)
+		return (false);
+
+	if (pthread_cond_init(&gp->cv, NULL) != 0) {
+		(void) pthread_mutex_destroy(&gp->lock);
+		return (false);
+	}
+
+	atomic_init(&gp->pending, 0);
+	return (true);
+}
+
+/*
+ * A group may only be destroyed once a wait on it has returned, or it is
+ * otherwise known to be empty.  The last sched_group_leave() is finished with
+ * the group by the time a waiter sees it empty; see there.
+ */
+void
+sched_group_destroy(sched_group_t *gp)
+{
+	assert(gp != NULL && atomic_load(&gp->pending) == 0);
+
+	(void) pthread_cond_destroy(&gp->cv);
+	(void) pthread_mutex_destroy(&gp->lock);
+}
+
+/*
+ * Work can be accounted to a group without going through sched_group_post(),
+ * for instance when a task hands off to a callback that finishes later.  Every
+ * enter must be balanced by a leave.
+ */
+void
+sched_group_enter(sched_group_t *gp)
+{
+	assert(gp != NULL);
+
+	(void) atomic_fetch_add(&gp->pending, 1);
+}
+
+/*
+ * Post every task in a notify chain.  Each task is detached from the chain
+ * first, since it is free to be reused once posted.
+ */
+static void
+post_notify_chain(task_t *tp)
+{
+	task_t *next;
+
+	for (; tp != NULL; tp = next) {
+		next = tp->next;
+		tp->next = NULL;
+		(void) sched_post(tp->post_sched, tp, true);
+	}
+}
+
+/*
+ * Whoever may be the last one out only drops the count with the lock held.
+ * That keeps us from slipping in between a waiter checking `pending' and going
+ * to sleep, and from racing sched_group_notify() for the notify chain.  It
+ * also means that a waiter who has seen the group empty while holding the
+ * lock knows that we are done with it, so a group can live on the stack of
+ * the task that waits on it.
+ */
+void
+sched_group_leave(sched_group_t *gp)
+{
+	task_t *notify;
+	int n;
+
+	assert(gp != NULL);
+
+	for (n = atomic_load(&gp->pending); n > 1; ) {
+		if (atomic_compare_exchange_weak(&gp->pending, &n, n - 1))
+			return;
+	}
+
+	(void) pthread_mutex_lock(&gp->lock);
+
+	if (atomic_fetch_sub(&gp->pending, 1) != 1) {
+		(void) pthread_mutex_unlock(&gp->lock);
+		return;
+	}
+
+	(void) pthread_cond_broadcast(&gp->cv);
+	notify = gp->notify;
+	gp->notify = NULL;
+	(void) pthread_mutex_unlock(&gp->lock);
+
+	post_notify_chain(notify);
+}
+
+/*
+ * Post a task as a member of the group.  Group members are always started
+ * immediately, since the whole point is that nobody calls sched_execute() to
+ * get them going.
+ */
+bool
+sched_group_post(sched_group_t *gp, sched_t *sp, task_t *tp)
+{
+	assert(gp != NULL && sp != NULL && tp != NULL);
+
+	tp->group = gp;
+	sched_group_enter(gp);
+
+	if (!sched_post(sp, tp, true)) {
+		tp->group = NULL;
+		sched_group_leave(gp);
+		return (false);
+	}
+
+	return (true);
+}
+
+/*
+ * Block until every task in the group has finished.  Only this group's tasks
+ * are waited for; the rest of the scheduler is free to carry on.
+ */
+void
+sched_group_wait(sched_group_t *gp)
+{
+	assert(gp != NULL);
+
+	(void) pthread_mutex_lock(&gp->lock);
+
+	while (atomic_load(&gp->pending) > 0)
+		(void) pthread_cond_wait(&gp->cv, &gp->lock);
+
+	(void) pthread_mutex_unlock(&gp->lock);
+}
+
+/*
+ * Arrange for `tp' to be posted to `sp' once the group is empty.  If it is
+ * already empty, the task is posted right away.
+ */
+void
+sched_group_notify(sched_group_t *gp, sched_t *sp, task_t *tp)
+{
+	assert(gp != NULL && sp != NULL && tp != NULL);
+
+	tp->post_sched = sp;
+
+	(void) pthread_mutex_lock(&gp->lock);
+
+	if (atomic_load(&gp->pending) > 0) {
+		tp->next = gp->notify;
+		gp->notify = tp;
+		(void) pthread_mutex_unlock(&gp->lock);
+		return;
+	}
+
+	(void) pthread_mutex_unlock(&gp->lock);
+
+	tp->next = NULL;
+	(void) sched_post(sp, tp, true);
+}
+
+/*
+ * Whether the calling thread is one of `sp's workers, and already as deep in
+ * sched_sync() helping as it is allowed to go.
+ */
+static bool
+help_exhausted(sched_t *sp)
+{
+	return (sched_current() == sp &&
+	    sp->workers[sched_current_worker()].help_depth >= SCHED_HELP_DEPTH);
+}
+
+/*
+ * Fork `tp' off as a member of `gp', to be joined with sched_sync().  If there
+ * is no room to queue it, it is run here and now instead, which is what would
+ * have become of it anyway.  The same goes for a task spawned by a worker that
+ * can help no deeper: it could not run the task while waiting for it, and the
+ * other workers may all be stuck in the same position.
+ */
+void
+sched_spawn(sched_t *sp, sched_group_t *gp, task_t *tp)
+{
+	assert(gp != NULL && sp != NULL && tp != NULL);
+
+	if (!help_exhausted(SCHED_HOST(sp)) && sched_group_post(gp, sp, tp))
+		return;
+
+	tp->group = gp;
+	sched_group_enter(gp);
+	sched_process_task(tp, sched_current() == SCHED_HOST(sp) ?
+	    sched_current_worker() : -1);
+}
+
+/*
+ * Wait for everything spawned in to `gp' to finish.  Called from one of `sp's
+ * own tasks, the worker runs other queued work while it waits instead of
+ * sleeping, so that a pool whose every worker is waiting on subtasks still
+ * gets them done.  When there is nothing to run, the tasks being waited on are
+ * running elsewhere, and the worker naps until they finish or more work turns
+ * up.  Anyone else just waits, as with sched_group_wait(), but blocks while
+ * it does so that the scheduler can start a worker in its place; see
+ * sched_block_begin().
+ */
+void
+sched_sync(sched_t *sp, sched_group_t *gp)
+{
+	sched_t *host = SCHED_HOST(sp);
+	struct timespec ts;
+	int id;
+
+	assert(gp != NULL && sp != NULL);
+
+	if (sched_current() != host) {
+		sched_block_begin();
+		sched_group_wait(gp);
+		sched_block_end();
+		return;
+	}
+
+	id = sched_current_worker();
+
+	for (;;) {
+		if (atomic_load(&gp->pending) > 0 && sched_help(sp, id))
+			continue;
+
+		/* Only seeing it empty under the lock will do. */
+		(void) pthread_mutex_lock(&gp->lock);
+
+		if (atomic_load(&gp->pending) == 0) {
+			(void) pthread_mutex_unlock(&gp->lock);
+			return;
+		}
+
+		(void) pthread_mutex_unlock(&gp->lock);
+
+		(void) clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += SCHED_SYNC_NAP;
+
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+
+		sched_block_begin();
+		(void) pthread_mutex_lock(&gp->lock);
+
+		if (atomic_load(&gp->pending) > 0)
+			(void) pthread_cond_timedwait(&gp->cv, &gp->lock, &ts);
+
+		(void) pthread_mutex_unlock(&gp->lock);
+		sched_block_end();
+	}
+}
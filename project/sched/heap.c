@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
 #include <assert.h>
@@ -16,12 +17,12 @@ heap_create(int capacity)
 
 	(void) bzero(hp, sizeof (heap_t));
 
-	if ((hp->data = malloc(sizeof (heap_elem_t) * capacity)) == NULL) {
+	/* An empty array could never be doubled. */
+	if (!expand(hp, capacity > 0 ? capacity : 1)) {
 		free(hp);
 		return (NULL);
 	}
 
-	hp->capacity = capacity;
 	return (hp);
 }
 
@@ -47,27 +48,122 @@ heap_insert(heap_t *hp, heap_elem_t elem)
 	if (heap_full(hp) && !heap_double(hp))
 		return (false);
 
-	hp->data[hp->total] = elem;
+	elem.seq = hp->seq++;
+	place(hp->data, hp->total, elem);
 	sift_up(hp->data, hp->total);
 	hp->total++;
 	return (true);
 }
 
+/*
+ * Insert `n' elements at once.  Sifting each one up costs O(n log total), while
+ * appending them all and rebuilding the heap from the bottom up costs
+ * O(total), so pick whichever is cheaper for this batch.
+ */
 bool
-heap_remove(heap_t *hp, heap_elem_t *elem)
+heap_insert_batch(heap_t *hp, heap_elem_t *elems, int n)
 {
 	int i;
+	int depth = 0;
+
+	assert(hp != NULL && (elems != NULL || n == 0));
+
+	while (hp->capacity - hp->total < n) {
+		if (!heap_double(hp))
+			return (false);
+	}
+
+	(void) memcpy(&hp->data[hp->total], elems, sizeof (heap_elem_t) * n);
+
+	for (i = 0; i < n; i++) {
+		hp->data[hp->total + i].seq = hp->seq++;
+		place(hp->data, hp->total + i, hp->data[hp->total + i]);
+	}
+
+	for (i = hp->total + n; i > 1; i >>= 1)
+		depth++;
+
+	if ((long)n * depth < hp->total + n) {
+		for (i = 0; i < n; i++)
+			sift_up(hp->data, hp->total + i);
 
+		hp->total += n;
+		return (true);
+	}
+
+	hp->total += n;
+	build_heap(hp->data, hp->total);
+	return (true);
+}
+
+bool
+heap_remove(heap_t *hp, heap_elem_t *elem)
+{
 	assert(hp != NULL && elem != NULL);
 
 	if (heap_empty(hp))
 		return (false);
 
-	*elem = hp->data[0];
+	return (heap_delete(hp, 0, elem));
+}
 
-	hp->data[0] = hp->data[hp->total - 1];
-	sift_down(hp->data, 0, hp->total - 1);
+/*
+ * Take out the element at position `i', wherever it is in the heap.
+ */
+bool
+heap_delete(heap_t *hp, int i, heap_elem_t *elem)
+{
+	heap_elem_t last;
+
+	assert(hp != NULL && elem != NULL);
+
+	if (i < 0 || i >= hp->total)
+		return (false);
+
+	*elem = hp->data[i];
 	hp->total--;
+
+	/* Fill the hole with the last element, which may belong either way. */
+	if (i != hp->total) {
+		last = hp->data[hp->total];
+		place(hp->data, i, last);
+
+		if (elem_before(&last, elem))
+			sift_up(hp->data, i);
+		else
+			sift_down(hp->data, i, hp->total);
+	}
+
+	if (elem->index != NULL)
+		*elem->index = -1;
+
+	return (true);
+}
+
+/*
+ * Change the value of the element at position `i'.  It goes behind anything
+ * already in the heap with the same value, as though it had just been
+ * inserted.
+ */
+bool
+heap_update(heap_t *hp, int i, uint64_t val)
+{
+	uint64_t old;
+
+	assert(hp != NULL);
+
+	if (i < 0 || i >= hp->total)
+		return (false);
+
+	old = hp->data[i].val;
+	hp->data[i].val = val;
+	hp->data[i].seq = hp->seq++;
+
+	if (val < old)
+		sift_up(hp->data, i);
+	else
+		sift_down(hp->data, i, hp->total);
+
 	return (true);
 }
 
@@ -92,29 +188,62 @@ heap_double(heap_t *hp)
 {
 	assert(hp != NULL);
 
-	if (!expand(&hp->data, hp->capacity))
+	return (expand(hp, hp->capacity > 0 ? hp->capacity * 2 : 1));
+}
+
+/*
+ * Grow the heap to hold `len' elements.  Shrinking is not supported.
+ */
+bool
+heap_resize(heap_t *hp, int len)
+{
+	assert(hp != NULL);
+
+	if (len < hp->capacity)
 		return (false);
 
-	hp->capacity *= 2;
-	return (true);
+	return (len == hp->capacity || expand(hp, len));
 }
 
 void
 heap_print(heap_t *hp)
 {
 	int i;
+	int level_end = 0;
 
 	assert(hp != NULL);
 
 	for (i = 0; i < hp->total; i++) {
-		printf("%d ", hp->data[i].val);
+		printf("%llu ", (unsigned long long)hp->data[i].val);
 
-		int x = i + 2;
-		if (!(x & (x - 1)))
+		/* End each level of the tree with a newline. */
+		if (i == level_end || i == hp->total - 1) {
 			printf("\n");
+			level_end = level_end * 2 + 2;
+		}
 	}
+}
 
-	printf("\n");
+/*
+ * Whether `a' belongs above `b'.  The sequence numbers break ties, so no two
+ * elements ever compare equal.
+ */
+static bool
+elem_before(const heap_elem_t *a, const heap_elem_t *b)
+{
+	return (a->val != b->val ? a->val < b->val : a->seq < b->seq);
+}
+
+/*
+ * Put `elem' at position `i', and tell it where it is.
+ */
+static void
+place(heap_elem_t *array, int i, heap_elem_t elem)
+{
+	array[i] = elem;
+
+	if (elem.index != NULL)
+		*elem.index = i;
 }
 
 static void
@@ -126,15 +255,15 @@ sift_up(heap_elem_t *array, int cur)
 	assert(array != NULL);
 
 	for (tmp = array[cur]; cur > 0; cur = parent) {
-		parent = cur / 2;
+		parent = (cur - 1) / 2;
 
-		if (tmp.val >= array[parent].val)
+		if (!elem_before(&tmp, &array[parent]))
 			break;
 
-		array[cur] = array[parent];
+		place(array, cur, array[parent]);
 	}
 
-	array[cur] = tmp;
+	place(array, cur, tmp);
 }
 
 static int
@@ -154,33 +283,51 @@ sift_down(heap_elem_t *array, int cur, int len)
 	for (tmp = array[cur]; left_child(cur) < len; cur = child) {
 		child = left_child(cur);
 
-		if (child != len - 1 && array[child].val > array[child + 1].val)
+		if (child != len - 1 &&
+		    elem_before(&array[child + 1], &array[child]))
 			child++;
 
-		if (tmp.val <= array[child].val)
+		if (!elem_before(&array[child], &tmp))
 			break;
 
-		array[cur] = array[child];
+		place(array, cur, array[child]);
 	}
 
-	array[cur] = tmp;
+	place(array, cur, tmp);
 }
 
-static bool
-expand(heap_elem_t **array, int len)
+static void
+build_heap(heap_elem_t *array, int len)
 {
 	int i;
-	int newlen = len * 2;
-	heap_elem_t *newarray;
 
-	assert(array != NULL && *array != NULL);
+	assert(array != NULL);
+
+	for (i = len / 2 - 1; i >= 0; i--)
+		sift_down(array, i, len);
+}
 
-	if ((newarray = malloc(sizeof (heap_elem_t) * newlen)) == NULL)
+/*
+ * Grow the heap's array to hold `newlen' elements.
+ */
+static bool
+expand(heap_t *hp, int newlen)
+{
+	heap_elem_t *data;
+
+	assert(hp != NULL);
+
+	if ((data = malloc(sizeof (heap_elem_t) * newlen)) == NULL)
 		return (false);
 
-	(void) bzero(newarray, sizeof (heap_elem_t) * newlen);
-	(void) memcpy(newarray, *array, sizeof (heap_elem_t) * len);
-	free(*array);
-	*array = newarray;
+	(void) bzero(data, sizeof (heap_elem_t) * newlen);
+
+	if (hp->data != NULL) {
+		(void) memcpy(data, hp->data, sizeof (heap_elem_t) * hp->total);
+		free(hp->data);
+	}
+
+	hp->data = data;
+	hp->capacity = newlen;
 	return (true);
 }
@@ -3,34 +3,52 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <ctype.h>
 
+/*
+ * Elements are ordered by `val', and then by `seq', which the heap stamps on
+ * each element as it goes in, so elements with equal values come out in the
+ * order they were inserted.  If `index' is set, the heap keeps the element's
+ * position there as it moves, and sets it to -1 once the element is out of
+ * the heap, so that it can be found again for heap_delete() and heap_update().
+ */
 typedef struct heap_elem {
-	int val;	/* Used when performing heap operations. */
+	uint64_t val;	/* Used when performing heap operations. */
+	uint64_t seq;
 	void *meta;	/* Used if we want to keep structures in the heap. */
+	int *index;	/* Where to track our position, or NULL. */
 } heap_elem_t;
 
 typedef struct heap {
 	int capacity;
 	int total;
+	uint64_t seq;	/* Stamped on the next element inserted. */
 	heap_elem_t *data;
 } heap_t;
 
 heap_t *heap_create(int);
 void heap_destroy(heap_t *);
 bool heap_insert(heap_t *, heap_elem_t);
+bool heap_insert_batch(heap_t *, heap_elem_t *, int);
 bool heap_remove(heap_t *, heap_elem_t *);
+bool heap_delete(heap_t *, int, heap_elem_t *);
+bool heap_update(heap_t *, int, uint64_t);
 bool heap_empty(heap_t *);
 bool heap_full(heap_t *);
 bool heap_double(heap_t *);
+bool heap_resize(heap_t *, int);
 void heap_print(heap_t *);
 
+static bool elem_before(const heap_elem_t *, const heap_elem_t *);
+static void place(heap_elem_t *, int, heap_elem_t);
 static void sift_down(heap_elem_t *, int, int);
 static void sift_up(heap_elem_t *, int);
-static bool expand(heap_elem_t **, int);
+static void build_heap(heap_elem_t *, int);
+static bool expand(heap_t *, int);
 
 
 #endif	/* _HEAP_H */
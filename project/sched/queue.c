@@ -0,0 +1,150 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "sched.h"
+#include "sched_impl.h"
+
+
+/*
+ * The most tasks a queue will run before giving its worker back to the pool,
+ * so that one busy queue can't monopolize a worker while others wait.
+ */
+#define	QUEUE_QUANTUM	16
+
+/*
+ * Hand the queue's drain to the pool.  A worker is only woken if the scheduler
+ * is running; a stopped one stays stopped until sched_execute().  If the pool's
+ * queue is full, the drain goes on the timer wheel instead, which keeps trying
+ * to post it once a tick, and still counts as outstanding work meanwhile.
+ * Returns false only if that fails too, when the scheduler is being torn down.
+ */
+static bool
+queue_schedule(sched_queue_t *qp)
+{
+	sched_t *sp = qp->sched;
+
+	return (sched_post(sp, &qp->drain, sp->state == SCHED_RUNNING) ||
+	    sched_post_delayed(sp, &qp->drain, 0));
+}
+
+/*
+ * The unit of work the pool sees.  Only one drain per queue is ever posted or
+ * running, which is what serializes the queue's tasks.  The drain's own task
+ * is reposted for the next round before this one has returned, so it is
+ * detached: the scheduler must not touch it once we are done with it.
+ */
+static void
+queue_drain(void *arg, int thread_num)
+{
+	sched_queue_t *qp = arg;
+	task_t *tp;
+	int i;
+
+	for (;;) {
+		for (i = 0; i < QUEUE_QUANTUM; i++) {
+			(void) pthread_mutex_lock(&qp->lock);
+
+			if ((tp = qp->head) == NULL) {
+				qp->scheduled = false;
+				(void) pthread_mutex_unlock(&qp->lock);
+				return;
+			}
+
+			if ((qp->head = tp->next) == NULL)
+				qp->tail = NULL;
+
+			tp->next = NULL;
+			(void) pthread_mutex_unlock(&qp->lock);
+
+			sched_process_task(tp, thread_num);
+		}
+
+		/*
+		 * We have used up our quantum.  If there is more to do, go to
+		 * the back of the line rather than running it now, unless
+		 * there is no line left to go to.
+		 */
+		(void) pthread_mutex_lock(&qp->lock);
+
+		if (qp->head == NULL) {
+			qp->scheduled = false;
+			(void) pthread_mutex_unlock(&qp->lock);
+			return;
+		}
+
+		(void) pthread_mutex_unlock(&qp->lock);
+
+		if (queue_schedule(qp))
+			return;
+	}
+}
+
+bool
+sched_queue_init(sched_queue_t *qp, sched_t *sp, uint64_t pri)
+{
+	assert(qp != NULL && sp != NULL);
+
+	bzero(qp, sizeof (sched_queue_t));
+
+	if (pthread_mutex_init(&qp->lock, NULL) != 0)
+		return (false);
+
+	qp->sched = sp;
+	task_init(&qp->drain, pri, queue_drain, qp);
+	qp->drain.flags |= TASK_DETACHED;
+	return (true);
+}
+
+/*
+ * The queue must be empty, with nothing running, before it is destroyed.
+ */
+void
+sched_queue_destroy(sched_queue_t *qp)
+{
+	assert(qp != NULL && qp->head == NULL);
+
+	(void) pthread_mutex_destroy(&qp->lock);
+}
+
+/*
+ * Append a task to the queue.  If the queue was idle, it is posted to the pool.
+ * The queue counts towards the scheduler's outstanding work for as long as its
+ * drain is posted or running, so sched_execute() waits for it.
+ */
+bool
+sched_queue_post(sched_queue_t *qp, task_t *tp)
+{
+	bool post;
+
+	assert(qp != NULL && tp != NULL);
+
+	tp->next = NULL;
+
+	(void) pthread_mutex_lock(&qp->lock);
+
+	if (qp->tail != NULL)
+		qp->tail->next = tp;
+	else
+		qp->head = tp;
+
+	qp->tail = tp;
+	post = !qp->scheduled;
+	qp->scheduled = true;
+	(void) pthread_mutex_unlock(&qp->lock);
+
+	/*
+	 * Only if the drain cannot be scheduled at all do we drain right here.
+	 * Other posters may already have appended behind us, believing the
+	 * drain was scheduled, so simply backing out is not an option.
+	 */
+	if (post && !queue_schedule(qp)) {
+		queue_drain(qp, sched_current() == qp->sched ?
+		    sched_current_worker() : -1);
+	}
+
+	return (true);
+}
@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <assert.h>
+
+#include "ring.h"
+
+
+bool
+ring_init(ring_t *rp, int capacity)
+{
+	size_t i;
+	size_t size = 2;
+
+	assert(rp != NULL);
+
+	/* Cells are indexed with a mask, so round up to a power of two. */
+	while (size < capacity)
+		size <<= 1;
+
+	if ((rp->cells = malloc(sizeof (ring_cell_t) * size)) == NULL)
+		return (false);
+
+	for (i = 0; i < size; i++) {
+		atomic_init(&rp->cells[i].seq, i);
+		rp->cells[i].data = NULL;
+	}
+
+	rp->mask = size - 1;
+	atomic_init(&rp->head, 0);
+	atomic_init(&rp->tail, 0);
+	return (true);
+}
+
+void
+ring_destroy(ring_t *rp)
+{
+	assert(rp != NULL);
+
+	free(rp->cells);
+}
+
+/*
+ * A cell is free for the producer at position `pos' once its sequence number
+ * equals `pos'.  After filling it, the producer advances the sequence to
+ * `pos + 1', which is what the consumer at that position is waiting for.
+ */
+bool
+ring_enqueue(ring_t *rp, void *item)
+{
+	ring_cell_t *cell;
+	size_t pos, seq;
+	intptr_t diff;
+
+	assert(rp != NULL);
+
+	pos = atomic_load_explicit(&rp->tail, memory_order_relaxed);
+
+	for (;;) {
+		cell = &rp->cells[pos & rp->mask];
+		seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+		diff = (intptr_t)seq - (intptr_t)pos;
+
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&rp->tail,
+			    &pos, pos + 1, memory_order_relaxed,
+			    memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			/* Not yet emptied by the consumer; we're full. */
+			return (false);
+		} else {
+			pos = atomic_load_explicit(&rp->tail,
+			    memory_order_relaxed);
+		}
+	}
+
+	cell->data = item;
+	atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+	return (true);
+}
+
+void *
+ring_dequeue(ring_t *rp)
+{
+	ring_cell_t *cell;
+	size_t pos, seq;
+	intptr_t diff;
+	void *item;
+
+	assert(rp != NULL);
+
+	pos = atomic_load_explicit(&rp->head, memory_order_relaxed);
+
+	for (;;) {
+		cell = &rp->cells[pos & rp->mask];
+		seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+		diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&rp->head,
+			    &pos, pos + 1, memory_order_relaxed,
+			    memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			/* Nothing has been published here yet; we're empty. */
+			return (NULL);
+		} else {
+			pos = atomic_load_explicit(&rp->head,
+			    memory_order_relaxed);
+		}
+	}
+
+	item = cell->data;
+	atomic_store_explicit(&cell->seq, pos + rp->mask + 1,
+	    memory_order_release);
+	return (item);
+}
+
+/*
+ * This is only a hint: a producer may have claimed a cell without having
+ * published its item yet.
+ */
+bool
+ring_empty(ring_t *rp)
+{
+	assert(rp != NULL);
+
+	return (atomic_load(&rp->tail) == atomic_load(&rp->head));
+}
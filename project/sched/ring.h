@@ -0,0 +1,33 @@
+#ifndef	_RING_H
+#define	_RING_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <assert.h>
+
+/*
+ * A bounded multi-producer/multi-consumer FIFO.  Each cell carries a sequence
+ * number that tells producers and consumers whether it is theirs to use, so
+ * both enqueue and dequeue cost a single CAS on the uncontended path.
+ */
+typedef struct ring_cell {
+	atomic_size_t seq;
+	void *data;
+} ring_cell_t;
+
+typedef struct ring {
+	_Alignas(64) atomic_size_t head;	/* Next cell to dequeue. */
+	_Alignas(64) atomic_size_t tail;	/* Next cell to enqueue. */
+	_Alignas(64) size_t mask;
+	ring_cell_t *cells;
+} ring_t;
+
+bool ring_init(ring_t *, int);
+void ring_destroy(ring_t *);
+bool ring_enqueue(ring_t *, void *);
+void *ring_dequeue(ring_t *);
+bool ring_empty(ring_t *);
+
+#endif	/* _RING_H */
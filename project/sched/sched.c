@@ -1,239 +1,2177 @@
 #include <stdlib.h>
+#include <limits.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <assert.h>
 
 #include "heap.h"
+#include "deque.h"
+#include "ring.h"
+#include "topology.h"
+#include "wheel.h"
 #include "sched.h"
+#include "sched_impl.h"
 
 
+/*
+ * The most tasks a worker will take off of the heap per lock acquisition, and
+ * the most sched_post_batch() will stage on the stack before it has to
+ * allocate.
+ */
+#define	SCHED_BATCH		8
+#define	SCHED_BATCH_STACK	64
+
+/*
+ * Bounds on an adaptive worker's spin budget, in rounds, and the most pauses
+ * in any one round.
+ */
+#define	SCHED_SPIN_MIN		4
+#define	SCHED_SPIN_MAX		64
+#define	SCHED_BACKOFF_MAX	64
+
+/*
+ * Under EDF, a task that can no longer make its deadline is keyed by its
+ * deadline with this bit set, which puts it behind every task that still can
+ * but ahead of those with no deadline at all.
+ */
+#define	EDF_LATE		(1ULL << 63)
+
+/* Tell the CPU we are busy-waiting, so it can back off the pipeline. */
+#if defined(__x86_64__) || defined(__i386__)
+#define	cpu_relax()	__builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define	cpu_relax()	__asm__ __volatile__("yield" ::: "memory")
+#else
+#define	cpu_relax()	atomic_signal_fence(memory_order_seq_cst)
+#endif
+
+static void pool_top_up(sched_t *);
+static void pool_kick(sched_t *);
+
+/*
+ * The worker that the calling thread is running as, or NULL if the calling
+ * thread is not one of our workers.  This is how sched_post() figures out that
+ * it has been called from within a task and can use the worker's own deque.
+ */
+static __thread worker_t *curworker = NULL;
+
+/*
+ * The lazy scheduler whose tasks the calling thread is running from within
+ * sched_execute(), if any.  Such a thread is no worker, but it stands in for
+ * one, and when one of its tasks blocks, a worker has to be started in its
+ * place.
+ */
+static __thread sched_t *curinline = NULL;
+
+/*
+ * Set on threads that must never wait for room in a queue, since they do
+ * nothing that would ever make any; see sched_post_never_wait().
+ */
+static __thread bool postnowait = false;
+
+/*
+ * CLOCK_MONOTONIC in ns, which is what deadlines and expiry times are kept in.
+ */
+uint64_t
+sched_clock(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/*
+ * Have sched_post() and friends fail straight away on a full queue when
+ * called from this thread, whatever the overflow policy.  The timer thread
+ * does this: waiting on one full queue would hold up every timer.
+ */
+void
+sched_post_never_wait(void)
+{
+	postnowait = true;
+}
+
+/*
+ * The `queued' and `top_pri' fields mirror the state of the heap so that
+ * workers can tell whether there is anything worth taking the lock for.  Must
+ * be called with `pq->lock' held.
+ */
+static void
+pq_update_top(priority_queue_t *pq)
+{
+	heap_t *hp = pq->heap;
+
+	atomic_store(&pq->queued, hp->total);
+
+#if SCHED_STATS
+	if (hp->total > atomic_load(&pq->hwm))
+		atomic_store(&pq->hwm, hp->total);
+#endif
+
+	if (!heap_empty(hp))
+		atomic_store(&pq->top_pri, hp->data[0].val);
+}
+
 static task_t *
-get_next_task(heap_t *hp)
+get_next_task(priority_queue_t *pq)
+{
+	heap_elem_t elem;
+
+	assert(pq != NULL);
+
+	if (!heap_remove(pq->heap, &elem))
+		return (NULL);
+
+	pq_update_top(pq);
+	return (elem.meta);
+}
+
+void
+task_init(task_t *tp, uint64_t pri, void (*fptr)(void *, int), void *args)
+{
+	assert(tp != NULL);
+
+	bzero(tp, sizeof (task_t));
+	tp->pri = pri;
+	tp->fptr = fptr;
+	tp->args = args;
+	tp->node = SCHED_NODE_ANY;
+	tp->heap_index = -1;
+}
+
+/*
+ * Hint that `tp' would like to run on NUMA node `node', typically because that
+ * is where its data lives.  `node' is the kernel's ID for it, as under
+ * /sys/devices/system/node.  This only has an effect on schedulers that keep
+ * per-node queues, and only for nodes that have CPUs; see sched_attr_t.
+ */
+void
+task_set_node(task_t *tp, int node)
+{
+	assert(tp != NULL);
+
+	tp->node = node;
+}
+
+/*
+ * Give `tp' a name to show in traces.  Only the pointer is kept, so the string
+ * has to stay around at least until the trace has been dumped.
+ */
+void
+task_set_name(task_t *tp, const char *name)
+{
+	assert(tp != NULL);
+
+	tp->name = name;
+}
+
+/*
+ * Ask for `tp' to be done within `ns' ns of now, and say that it expects to
+ * run for about `cost' ns.  The deadline orders the heaps of an EDF scheduler;
+ * under any policy, statistics count whether it was met.
+ */
+void
+task_set_deadline(task_t *tp, uint64_t ns, uint64_t cost)
+{
+	assert(tp != NULL);
+
+	tp->deadline = sched_clock() + ns;
+	tp->cost = cost;
+}
+
+/*
+ * Give up on `tp' if it has not been started in time to finish within `ns' ns
+ * of now, going by the cost given to task_set_deadline().  Instead of running
+ * it, a worker hands it to the scheduler's expiry callback, if there is one,
+ * and otherwise drops it.  A detached task that may expire needs a callback to
+ * free it.
+ */
+void
+task_set_expiry(task_t *tp, uint64_t ns)
+{
+	assert(tp != NULL);
+
+	tp->expires = sched_clock() + ns;
+}
+
+/*
+ * Put `tp' in QoS class `qos'.  This only has an effect on schedulers using
+ * SCHED_POLICY_QOS; see sched_policy_t.
+ */
+void
+task_set_qos(task_t *tp, sched_qos_t qos)
+{
+	assert(tp != NULL && qos >= 0 && qos < SCHED_QOS_CLASSES);
+
+	tp->qos = qos;
+}
+
+/*
+ * How far behind a task of priority 0 a task of priority `pri' is queued under
+ * QoS.  It is capped well short of overflowing a key.
+ */
+static uint64_t
+qos_bias(sched_t *sp, uint64_t pri)
+{
+	if (sp->aging == 0)
+		return (0);
+
+	if (pri >= (UINT64_MAX >> 2) / sp->aging)
+		return (UINT64_MAX >> 2);
+
+	return (pri * sp->aging);
+}
+
+/*
+ * Where `tp' goes in `sp's heaps.  Under QoS, that is when it would have had to
+ * be posted at priority 0 to be queued alongside.
+ */
+static uint64_t
+task_key(sched_t *sp, task_t *tp)
+{
+	if (sp->policy == SCHED_POLICY_PRIORITY)
+		return (tp->pri);
+
+	if (sp->policy == SCHED_POLICY_QOS)
+		return (sched_clock() + qos_bias(sp, tp->pri));
+
+	return (tp->deadline != 0 ? tp->deadline : UINT64_MAX);
+}
+
+/*
+ * The heap that tasks of class `qos' are posted to.  The default class has the
+ * shared heap, along with the FIFO lane and the nodes' heaps.
+ */
+static priority_queue_t *
+qos_queue(sched_t *sp, sched_qos_t qos)
+{
+	if (sp->num_qos_pq == 0 || qos == SCHED_QOS_DEFAULT)
+		return (&sp->pq);
+
+	return (&sp->qos_pq[qos - 1]);
+}
+
+/*
+ * The index of the calling thread in `sp's table of workers, or -1 if the
+ * caller is not one of them.
+ */
+static int
+worker_index(sched_t *sp)
+{
+	if (curworker == NULL || curworker->sched != sp)
+		return (-1);
+
+	return (curworker->id);
+}
+
+/*
+ * Once a task's `succ' list has been swapped for this sentinel, the task has
+ * started, and any edge added afterwards counts as already satisfied.
+ */
+static task_edge_t task_started;
+
+/*
+ * Stamp a task as it is queued, for statistics and tracing.  A task that has
+ * run before may be posted again without task_init(), and starts out with no
+ * successors again.
+ */
+static void
+task_posted(sched_t *sp, task_t *tp)
+{
+	task_edge_t *ep = &task_started;
+
+	(void) atomic_compare_exchange_strong(&tp->succ, &ep, NULL);
+	atomic_store(&tp->deps_left, 0);
+	STATS_POSTED(sp, tp);
+	TRACE(sp, worker_index(sp), SCHED_TRACE_POST, tp, tp->name);
+}
+
+/*
+ * A task posted with sched_post_after() has had its last predecessor finish.
+ * sched_post_after() took a hold on `remaining_tasks' for it so that
+ * sched_execute() could not return while it was still waiting; now that it is
+ * queued, the hold can be dropped.  Whoever released it may be no worker, so
+ * rather than run it here when the queue is full, it goes on to the timer
+ * wheel, which keeps trying to post it.  Only a scheduler that is being torn
+ * down drops it.
+ */
+static void
+task_runnable(task_t *tp)
+{
+	sched_t *sp = tp->post_sched;
+	bool run_now = (tp->flags & TASK_RUN_NOW) != 0;
+
+	free(tp->edges);
+	tp->edges = NULL;
+	tp->flags &= ~TASK_RUN_NOW;
+
+	if (!sched_post(sp, tp, run_now))
+		(void) sched_post_delayed(sp, tp, 0);
+
+	sched_tasks_done(sp, 1);
+}
+
+/*
+ * Take a task's successors as it starts, so that they can be released once it
+ * is done without touching the task again; it may well have been freed or
+ * reused by then.
+ */
+static task_edge_t *
+take_successors(task_t *tp)
+{
+	task_edge_t *ep = atomic_exchange(&tp->succ, &task_started);
+
+	return (ep != &task_started ? ep : NULL);
+}
+
+static void
+release_successors(task_edge_t *ep)
+{
+	task_edge_t *next;
+	task_t *succ;
+
+	for (; ep != NULL; ep = next) {
+		/* `ep' belongs to `succ' and may be freed once it runs. */
+		next = ep->next;
+		succ = ep->task;
+
+		if (atomic_fetch_sub(&succ->deps_left, 1) == 1)
+			task_runnable(succ);
+	}
+}
+
+void
+sched_process_task(task_t *tp, int thread_num)
+{
+	sched_group_t *group;
+	task_edge_t *succ;
+
+	assert(tp != NULL);
+
+	/* The task may be freed or reused by its own function, so look first. */
+	group = tp->group;
+	succ = take_successors(tp);
+	tp->fptr(tp->args, thread_num);
+	release_successors(succ);
+
+	if (group != NULL)
+		sched_group_leave(group);
+}
+
+/*
+ * Finish off a task that has expired without running it.
+ */
+static void
+task_expire(sched_t *sp, task_t *tp, int thread_num)
+{
+	sched_group_t *group = tp->group;
+	task_edge_t *succ = take_successors(tp);
+
+	if (sp->expire != NULL)
+		sp->expire(tp, thread_num);
+
+	release_successors(succ);
+
+	if (group != NULL)
+		sched_group_leave(group);
+}
+
+/*
+ * Account for `n' finished tasks.  Only the final task needs the lock, and
+ * only so that it cannot slip in between sched_execute() checking the count and
+ * going to sleep.
+ */
+void
+sched_tasks_done(sched_t *sp, int n)
+{
+	priority_queue_t *pq = &sp->pq;
+
+	if (atomic_fetch_sub(&pq->remaining_tasks, n) == n) {
+		(void) pthread_mutex_lock(&pq->lock);
+		(void) pthread_cond_broadcast(&pq->drain_cv);
+		(void) pthread_mutex_unlock(&pq->lock);
+	}
+}
+
+/*
+ * Wake a sleeping worker, but only if there is one and nobody is spinning who
+ * will pick the task up anyway.  The fence orders the caller's publication of
+ * the task before the loads of the counts; a worker bumps `idle_workers' before
+ * its last look for work, and fences after it stops spinning, so one of us is
+ * guaranteed to see the other.
+ */
+static void
+wake_worker(sched_t *sp)
+{
+	priority_queue_t *pq = &sp->pq;
+
+	if (sp->pool != NULL) {
+		pool_kick(sp);
+		return;
+	}
+
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (atomic_load(&sp->spinning_workers) == 0 &&
+	    atomic_load(&sp->idle_workers) > 0) {
+		(void) pthread_mutex_lock(&pq->lock);
+		(void) pthread_cond_signal(&pq->cv);
+		(void) pthread_mutex_unlock(&pq->lock);
+	} else {
+		pool_top_up(sp);
+	}
+}
+
+/*
+ * Move the tasks at the top of an EDF heap that could not finish in time if
+ * started at `now' behind the ones that still could, so that one late task
+ * does not make everything queued behind it late as well.  Each task is only
+ * moved the once, and late tasks stay in deadline order among themselves.
+ * Must be called with `pq->lock' held.
+ */
+static void
+edf_demote(priority_queue_t *pq, uint64_t now)
+{
+	heap_t *hp = pq->heap;
+	task_t *tp;
+
+	while (!heap_empty(hp) && hp->data[0].val < EDF_LATE) {
+		tp = hp->data[0].meta;
+
+		if (now + tp->cost <= tp->deadline)
+			break;
+
+		(void) heap_update(hp, 0, tp->deadline | EDF_LATE);
+	}
+}
+
+/*
+ * Pull tasks off of a heap: either the shared one, which is where tasks posted
+ * from outside of the scheduler land even in SCHED_MODE_STEAL, or one of the
+ * per-node ones.  To keep lock traffic down we take up to SCHED_BATCH tasks at
+ * a time, but never more than our fair share of what is queued, so that a
+ * handful of tasks still spreads out across all of the workers.  An elastic
+ * pool takes one task at a time: its tasks are expected to block, and the rest
+ * of a batch would be stuck behind the one that did instead of going to the
+ * worker started to stand in for it.  Under EDF, each task in the batch is
+ * expected to start once those before it are done.
+ */
+static int
+heap_next_tasks(sched_t *sp, priority_queue_t *pq, task_t **tasks)
+{
+	uint64_t now = 0;
+	int n = 0;
+	int max;
+
+	if (atomic_load(&pq->queued) == 0)
+		return (0);
+
+	if (sp->policy == SCHED_POLICY_EDF)
+		now = sched_clock();
+
+	STATS_LOCK(STATS_WORKER(sp, worker_index(sp)), &pq->lock);
+
+	if (sp->state != SCHED_STOPPED) {
+		max = atomic_load(&sp->live_workers) +
+		    atomic_load(&sp->inline_runners);
+		max = pq->heap->total / (max < 1 ? 1 : max);
+		max = max < 1 ? 1 : max > SCHED_BATCH ? SCHED_BATCH : max;
+
+		if (sp->num_workers > sp->min_workers)
+			max = 1;
+
+		while (n < max) {
+			if (now != 0)
+				edf_demote(pq, now);
+
+			if ((tasks[n] = get_next_task(pq)) == NULL)
+				break;
+
+			now += tasks[n++]->cost;
+		}
+	}
+
+	if (n > 0 && pq->producers > 0)
+		(void) pthread_cond_broadcast(&pq->space_cv);
+
+	(void) pthread_mutex_unlock(&pq->lock);
+
+	return (n);
+}
+
+/*
+ * Of the shared heap and our own node's heap, the one with the more urgent
+ * task on top, or NULL if both are empty.
+ */
+static priority_queue_t *
+urgent_pq(sched_t *sp, int thread_num)
+{
+	priority_queue_t *pq = &sp->pq;
+	priority_queue_t *npq;
+	int node;
+
+	if (sp->num_nodes == 0 ||
+	    (node = sp->workers[thread_num].node) == SCHED_NODE_ANY)
+		return (atomic_load(&pq->queued) > 0 ? pq : NULL);
+
+	npq = &sp->node_pq[node];
+
+	if (atomic_load(&npq->queued) == 0)
+		return (atomic_load(&pq->queued) > 0 ? pq : NULL);
+
+	if (atomic_load(&pq->queued) == 0 ||
+	    atomic_load(&npq->top_pri) <= atomic_load(&pq->top_pri))
+		return (npq);
+
+	return (pq);
+}
+
+/*
+ * The FIFO lane sits at SCHED_PRI_DEFAULT, or under EDF, alongside the tasks
+ * that have no deadline.  Under QoS, that is where a task of that priority
+ * posted now would go.  Anything in the heaps that is at least that urgent
+ * goes first.  Other nodes' queues are only raided once there is nothing closer
+ * to hand.
+ */
+static int
+default_next_tasks(sched_t *sp, int thread_num, task_t **tasks)
+{
+	priority_queue_t *pq;
+	uint64_t fifo = SCHED_PRI_DEFAULT;
+	int i, n;
+
+	if (sp->policy == SCHED_POLICY_EDF)
+		fifo = UINT64_MAX;
+	else if (sp->policy == SCHED_POLICY_QOS)
+		fifo = sched_clock() + qos_bias(sp, SCHED_PRI_DEFAULT);
+
+	if ((pq = urgent_pq(sp, thread_num)) != NULL &&
+	    atomic_load(&pq->top_pri) <= fifo &&
+	    (n = heap_next_tasks(sp, pq, tasks)) > 0)
+		return (n);
+
+	if (sp->state != SCHED_STOPPED &&
+	    (tasks[0] = ring_dequeue(&sp->fifo)) != NULL)
+		return (1);
+
+	if ((pq = urgent_pq(sp, thread_num)) != NULL &&
+	    (n = heap_next_tasks(sp, pq, tasks)) > 0)
+		return (n);
+
+	for (i = 0; i < sp->num_nodes; i++) {
+		if ((n = heap_next_tasks(sp, &sp->node_pq[i], tasks)) > 0)
+			return (n);
+	}
+
+	return (0);
+}
+
+static int
+class_next_tasks(sched_t *sp, int qos, int thread_num, task_t **tasks)
+{
+	if (qos == SCHED_QOS_DEFAULT)
+		return (default_next_tasks(sp, thread_num, tasks));
+
+	return (heap_next_tasks(sp, &sp->qos_pq[qos - 1], tasks));
+}
+
+/*
+ * End class `qos's turn, unless another worker already has, and hand the turn,
+ * and its weight in credit, to the next class.  A class is left with whatever
+ * debt it ran up by taking a whole batch, but a class that ran out of work
+ * before it ran out of credit does not get to bank the rest.
+ */
+static void
+qos_next_turn(sched_t *sp, int qos)
+{
+	int next = (qos + 1) % SCHED_QOS_CLASSES;
+
+	if (!atomic_compare_exchange_strong(&sp->qos_turn, &qos, next))
+		return;
+
+	if (atomic_load(&sp->qos_credit[qos]) > 0)
+		atomic_store(&sp->qos_credit[qos], 0);
+
+	(void) atomic_fetch_add(&sp->qos_credit[next], sp->qos_weight[next]);
+}
+
+/*
+ * Deficit round-robin between the QoS classes: the class whose turn it is
+ * runs tasks until it has used up its credit or has nothing left, and then
+ * the turn moves on.  If no class that is owed a turn has work, whatever work
+ * there is gets run anyway, so no worker idles while tasks wait.  Workers take
+ * turns without a lock, so shares are only approximately kept.
+ */
+static int
+qos_next_tasks(sched_t *sp, int thread_num, task_t **tasks)
+{
+	int i, n, qos;
+
+	for (i = 0; i <= SCHED_QOS_CLASSES; i++) {
+		qos = atomic_load(&sp->qos_turn);
+
+		if (atomic_load(&sp->qos_credit[qos]) > 0 &&
+		    (n = class_next_tasks(sp, qos, thread_num, tasks)) > 0) {
+			(void) atomic_fetch_sub(&sp->qos_credit[qos], n);
+			return (n);
+		}
+
+		qos_next_turn(sp, qos);
+	}
+
+	for (qos = 0; qos < SCHED_QOS_CLASSES; qos++) {
+		if ((n = class_next_tasks(sp, qos, thread_num, tasks)) > 0)
+			return (n);
+	}
+
+	return (0);
+}
+
+static int
+shared_next_tasks(sched_t *sp, int thread_num, task_t **tasks)
+{
+	if (sp->num_qos_pq > 0)
+		return (qos_next_tasks(sp, thread_num, tasks));
+
+	return (default_next_tasks(sp, thread_num, tasks));
+}
+
+/*
+ * Victims on our own node are tried first, so that stolen work is more likely
+ * to find its data in a nearby cache.
+ */
+static task_t *
+steal_from_peers(sched_t *sp, int thread_num)
+{
+	int i, pass;
+	int node = sp->workers[thread_num].node;
+	worker_t *victim;
+	task_t *task;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 1; i < sp->num_workers; i++) {
+			victim = &sp->workers[(thread_num + i) %
+			    sp->num_workers];
+
+			if ((victim->node == node) != (pass == 0))
+				continue;
+
+			if ((task = deque_steal(&victim->deque)) != NULL) {
+				STATS_INC(STATS_WORKER(sp, thread_num), steals);
+				return (task);
+			}
+		}
+	}
+
+	return (NULL);
+}
+
+static int
+steal_next_tasks(sched_t *sp, int thread_num, task_t **tasks)
+{
+	priority_queue_t *pq;
+	deque_t *dp = &sp->workers[thread_num].deque;
+	task_t *task;
+	int i, n;
+
+	/*
+	 * Our own deque comes first, unless a heap is holding something more
+	 * urgent.  Priorities are only compared against the top of the heaps;
+	 * tasks within a deque run newest first.
+	 */
+	if ((task = deque_take(dp)) != NULL) {
+		if ((pq = urgent_pq(sp, thread_num)) == NULL ||
+		    task_key(sp, task) <= atomic_load(&pq->top_pri) ||
+		    !deque_push(dp, task)) {
+			tasks[0] = task;
+			return (1);
+		}
+	}
+
+	/*
+	 * Anything extra we took from the heap goes on to our deque, where it
+	 * can still be stolen by an idle peer.  The deque is LIFO for us, so
+	 * push in reverse to keep running them in priority order.
+	 */
+	if ((n = shared_next_tasks(sp, thread_num, tasks)) > 0) {
+		for (i = n - 1; i > 0; i--) {
+			if (!deque_push(dp, tasks[i]))
+				return (i + 1);
+		}
+
+		return (1);
+	}
+
+	if ((tasks[0] = deque_take(dp)) != NULL)
+		return (1);
+
+	return ((tasks[0] = steal_from_peers(sp, thread_num)) != NULL);
+}
+
+/*
+ * Must be called with `pq->lock' held.
+ */
+static bool
+work_available(sched_t *sp)
+{
+	int i;
+
+	if (sp->state != SCHED_STOPPED &&
+	    (!heap_empty(sp->pq.heap) || !ring_empty(&sp->fifo)))
+		return (true);
+
+	for (i = 0; i < sp->num_nodes; i++) {
+		if (sp->state != SCHED_STOPPED &&
+		    atomic_load(&sp->node_pq[i].queued) > 0)
+			return (true);
+	}
+
+	for (i = 0; i < sp->num_qos_pq; i++) {
+		if (sp->state != SCHED_STOPPED &&
+		    atomic_load(&sp->qos_pq[i].queued) > 0)
+			return (true);
+	}
+
+	if (sp->mode != SCHED_MODE_STEAL)
+		return (false);
+
+	for (i = 0; i < sp->num_workers; i++) {
+		if (!deque_empty(&sp->workers[i].deque))
+			return (true);
+	}
+
+	return (false);
+}
+
+/*
+ * A lock-free look at whether there might be work, for spinning workers.  It
+ * reads the same queues as work_available(), through their atomic mirrors.
+ */
+static bool
+work_hint(sched_t *sp)
+{
+	int i;
+
+	if (sp->state != SCHED_STOPPED &&
+	    (atomic_load(&sp->pq.queued) > 0 || !ring_empty(&sp->fifo)))
+		return (true);
+
+	for (i = 0; i < sp->num_nodes; i++) {
+		if (sp->state != SCHED_STOPPED &&
+		    atomic_load(&sp->node_pq[i].queued) > 0)
+			return (true);
+	}
+
+	for (i = 0; i < sp->num_qos_pq; i++) {
+		if (sp->state != SCHED_STOPPED &&
+		    atomic_load(&sp->qos_pq[i].queued) > 0)
+			return (true);
+	}
+
+	if (sp->mode != SCHED_MODE_STEAL)
+		return (false);
+
+	for (i = 0; i < sp->num_workers; i++) {
+		if (!deque_empty(&sp->workers[i].deque))
+			return (true);
+	}
+
+	return (false);
+}
+
+/*
+ * Posts that find a worker spinning leave the others asleep, trusting it to
+ * pick the work up, so a burst of posts may wake nobody.  A worker that takes
+ * work while more is still queued therefore wakes the next one, under the
+ * same rules as wake_worker(), and a burst spreads out one wakeup at a time.
+ * The lock is only taken when somebody is actually asleep.
+ */
+static void
+wake_next(sched_t *sp)
+{
+	priority_queue_t *pq = &sp->pq;
+
+	if (atomic_load(&sp->idle_workers) == 0 ||
+	    atomic_load(&sp->spinning_workers) > 0 || !work_hint(sp))
+		return;
+
+	(void) pthread_mutex_lock(&pq->lock);
+	(void) pthread_cond_signal(&pq->cv);
+	(void) pthread_mutex_unlock(&pq->lock);
+}
+
+/*
+ * Spin for a while before parking, in the hope that work turns up before it
+ * would be worth paying for a trip through the kernel.  Each round pauses
+ * twice as long as the last.  An adaptive worker doubles its budget whenever
+ * spinning finds work and halves it whenever it does not, so workers only spin
+ * for as long as it has recently been paying off.
+ */
+static bool
+worker_spin(sched_t *sp, worker_t *wp)
+{
+	int round, i;
+	int backoff = 1;
+	bool found = false;
+
+	if (wp->spin == 0)
+		return (false);
+
+	(void) atomic_fetch_add(&sp->spinning_workers, 1);
+
+	for (round = 0; round < wp->spin && sp->state != SCHED_DONE; round++) {
+		if ((found = work_hint(sp)))
+			break;
+
+		for (i = 0; i < backoff; i++)
+			cpu_relax();
+
+		if (backoff < SCHED_BACKOFF_MAX)
+			backoff <<= 1;
+	}
+
+	/* Pairs with the fence in wake_worker(); see there. */
+	(void) atomic_fetch_sub(&sp->spinning_workers, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (sp->spin == SCHED_SPIN_ADAPTIVE) {
+		wp->spin = found ? wp->spin * 2 : wp->spin / 2;
+		wp->spin = wp->spin < SCHED_SPIN_MIN ? SCHED_SPIN_MIN :
+		    wp->spin > SCHED_SPIN_MAX ? SCHED_SPIN_MAX : wp->spin;
+	}
+
+	return (found);
+}
+
+/*
+ * The task may be freed by its own function, so anything the statistics and
+ * trace need from it is read up front.  A task that could not finish before it
+ * expires is not run at all.
+ */
+static void
+worker_run(sched_t *sp, sched_worker_stats_t *ws, task_t *tp, int thread_num)
+{
+	uint64_t posted = tp->posted;
+	uint64_t deadline = tp->deadline;
+#if SCHED_TRACE
+	const char *name = tp->name;
+#endif
+	uint64_t start;
+
+	if (tp->expires != 0 && sched_clock() + tp->cost > tp->expires) {
+		task_expire(sp, tp, thread_num);
+		STATS_INC(ws, expired);
+		return;
+	}
+
+	start = STATS_CLOCK(ws);
+	TRACE(sp, thread_num, SCHED_TRACE_START, tp, name);
+	sched_process_task(tp, thread_num);
+	TRACE(sp, thread_num, SCHED_TRACE_END, tp, name);
+	STATS_RAN(ws, posted, start, deadline);
+}
+
+static int
+next_tasks(sched_t *sp, int thread_num, task_t **tasks)
+{
+	if (sp->mode == SCHED_MODE_STEAL)
+		return (steal_next_tasks(sp, thread_num, tasks));
+
+	return (shared_next_tasks(sp, thread_num, tasks));
+}
+
+static void
+worker_loop(sched_t *sp, int thread_num)
+{
+	priority_queue_t *pq = &sp->pq;
+	sched_worker_stats_t *ws = STATS_WORKER(sp, thread_num);
+	task_t *tasks[SCHED_BATCH];
+	bool extra = thread_num >= sp->min_workers;
+	bool done = false;
+	struct timespec deadline;
+	uint64_t idle;
+	int i, n, rc;
+
+	while (!done) {
+		n = next_tasks(sp, thread_num, tasks);
+
+		/*
+		 * There is no gaurantee that we will have work to do.
+		 * Another thread may have beat us to get whatever the next
+		 * task is, leaving the queue empty.  If that's the case, we
+		 * will just basically go back to sleep (below).
+		 */
+		if (n > 0) {
+			if (sp->lazy > 0)
+				pool_top_up(sp);
+
+			wake_next(sp);
+
+			for (i = 0; i < n; i++)
+				worker_run(sp, ws, tasks[i], thread_num);
+
+			sched_tasks_done(sp, n);
+			continue;
+		}
+
+		idle = STATS_CLOCK(ws);
+		TRACE(sp, thread_num, SCHED_TRACE_IDLE, NULL, NULL);
+
+		if (worker_spin(sp, &sp->workers[thread_num])) {
+			STATS_SINCE(ws, idle_ns, idle);
+			TRACE(sp, thread_num, SCHED_TRACE_BUSY, NULL, NULL);
+			continue;
+		}
+
+		/*
+		 * Advertise that we are about to sleep _before_ the final
+		 * check for work; see wake_worker().  If the `done' latch has
+		 * been set and there is nothing left, then no more work is
+		 * coming and this worker is free to exit.  A worker that was
+		 * started to stand in for blocked ones retires once it has
+		 * been idle for `idle_timeout', as long as enough others are
+		 * left running.
+		 */
+		STATS_LOCK(ws, &pq->lock);
+		(void) atomic_fetch_add(&sp->idle_workers, 1);
+
+		if (extra) {
+			(void) clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += sp->idle_timeout / 1000;
+			deadline.tv_nsec += (sp->idle_timeout % 1000) * 1000000;
+
+			if (deadline.tv_nsec >= 1000000000) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000;
+			}
+		}
+
+		while (!work_available(sp)) {
+			if (sp->state == SCHED_DONE) {
+				done = true;
+				break;
+			}
+
+			if (!extra) {
+				(void) pthread_cond_wait(&pq->cv, &pq->lock);
+				STATS_INC(ws, wakeups);
+				continue;
+			}
+
+			rc = pthread_cond_timedwait(&pq->cv, &pq->lock,
+			    &deadline);
+			STATS_INC(ws, wakeups);
+
+			if (rc == ETIMEDOUT && !work_available(sp) &&
+			    atomic_load(&sp->live_workers) -
+			    atomic_load(&sp->blocked_workers) >
+			    sp->min_workers) {
+				sp->workers[thread_num].running = false;
+				(void) atomic_fetch_sub(&sp->live_workers, 1);
+				done = true;
+				break;
+			}
+		}
+
+		(void) atomic_fetch_sub(&sp->idle_workers, 1);
+		(void) pthread_mutex_unlock(&pq->lock);
+		STATS_SINCE(ws, idle_ns, idle);
+		TRACE(sp, thread_num, SCHED_TRACE_BUSY, NULL, NULL);
+	}
+}
+
+/*
+ * Run a batch of whatever the calling worker would have picked up next, on
+ * behalf of one of `sp's tasks that is waiting in sched_sync().  Whatever runs
+ * here sits on top of the waiting task's stack, and may sync and help in turn,
+ * so a worker stops helping once it is SCHED_HELP_DEPTH tasks deep.  For an
+ * attached scheduler, the caller is one of the pool's workers, and `sp's own
+ * queue comes first: every pump it is allowed may be busy waiting, like this
+ * one, so nobody else may be able to run it.  Returns whether anything was
+ * run.
+ */
+bool
+sched_help(sched_t *sp, int thread_num)
+{
+	sched_t *host = SCHED_HOST(sp);
+	worker_t *wp = &host->workers[thread_num];
+	task_t *tasks[SCHED_BATCH];
+	int i, n;
+
+	if (wp->help_depth >= SCHED_HELP_DEPTH)
+		return (false);
+
+	if (sp == host || (n = shared_next_tasks(sp, -1, tasks)) == 0) {
+		sp = host;
+
+		if ((n = next_tasks(sp, thread_num, tasks)) == 0)
+			return (false);
+	}
+
+	wp->help_depth++;
+
+	for (i = 0; i < n; i++)
+		worker_run(sp, STATS_WORKER(sp, thread_num), tasks[i],
+		    thread_num);
+
+	wp->help_depth--;
+	sched_tasks_done(sp, n);
+	return (true);
+}
+
+/*
+ * A pump runs an attached scheduler's tasks on one of its pool's workers, for
+ * as long as it has any, much as that scheduler's own worker would.  After
+ * every SCHED_PUMP_QUANTUM tasks it posts itself again, so that the pool's
+ * other work gets a turn.  Only once there is nothing left does it stop
+ * counting as one of the scheduler's pumps, and after that it must not touch
+ * the scheduler, which may be on its way out of sched_fini().
+ */
+static void
+pool_pump(void *arg, int thread_num)
+{
+	sched_t *sp = *(sched_t **)arg;
+	priority_queue_t *pq = &sp->pq;
+	task_t *tasks[SCHED_BATCH];
+	int i, n, ran;
+
+	for (;;) {
+		for (ran = 0; ran < SCHED_PUMP_QUANTUM &&
+		    (n = shared_next_tasks(sp, -1, tasks)) > 0; ran += n) {
+			for (i = 0; i < n; i++)
+				worker_run(sp, NULL, tasks[i], thread_num);
+
+			sched_tasks_done(sp, n);
+		}
+
+		(void) pthread_mutex_lock(&pq->lock);
+
+		if (!work_available(sp)) {
+			if (atomic_fetch_sub(&sp->pumps, 1) == 1)
+				(void) pthread_cond_broadcast(&pq->drain_cv);
+
+			(void) pthread_mutex_unlock(&pq->lock);
+			return;
+		}
+
+		(void) pthread_mutex_unlock(&pq->lock);
+
+		/* If we can't requeue, just carry on. */
+		if (sched_async(sp->pool, sp->pool_pri, pool_pump, &sp,
+		    sizeof (sp)))
+			return;
+	}
+}
+
+/*
+ * Start another pump for an attached scheduler, if it has work and fewer than
+ * `weight' pumps.  The check is made under the lock that pumps hold when they
+ * decide to stop, so a task can never be left behind with nobody to run it.
+ * Tasks are run right here if the pool has no room for another pump.
+ */
+static void
+pool_kick(sched_t *sp)
+{
+	priority_queue_t *pq = &sp->pq;
+	sched_t *pool = sp->pool;
+	bool start;
+
+	(void) pthread_mutex_lock(&pq->lock);
+
+	if ((start = sp->state != SCHED_STOPPED &&
+	    atomic_load(&sp->pumps) < sp->weight && work_available(sp)))
+		(void) atomic_fetch_add(&sp->pumps, 1);
+
+	(void) pthread_mutex_unlock(&pq->lock);
+
+	if (start && !sched_async(pool, sp->pool_pri, pool_pump, &sp,
+	    sizeof (sp)))
+		pool_pump(&sp, sched_current() == pool ?
+		    sched_current_worker() : -1);
+}
+
+static void *
+worker_func(void *arg)
+{
+	worker_t *wp = arg;
+
+	assert(wp != NULL);
+
+	/*
+	 * Under normal circumstances, it does not matter what thread does the
+	 * work as long as it gets done, but there may be circumstances where
+	 * we want certain workers to always process the same part of a given
+	 * problem.  Such examples include, but are not limited to parallel
+	 * compression over a network.  Knowing the index of this thread in
+	 * our table of workers will allow applications to do things like direct
+	 * the nth worker at the nth chunk of a block that all threads have
+	 * access to.  The index is handed to us at creation time and stashed in
+	 * thread-local storage, so that tasks can look it up without a lock.
+	 */
+	curworker = wp;
+
+	/*
+	 * Pin ourselves before touching any memory, so that whatever we
+	 * allocate from here on is local to the node we run on.  Placement is
+	 * best-effort; if the CPU is not available to us we run unpinned.
+	 */
+	if (wp->cpu >= 0) {
+		(void) topology_bind(&wp->cpu, 1);
+	} else if (wp->node != SCHED_NODE_ANY) {
+		(void) topology_bind(wp->sched->topo.node_cpus[wp->node],
+		    wp->sched->topo.node_ncpus[wp->node]);
+	}
+	worker_loop(wp->sched, wp->id);
+
+	return (NULL);
+}
+
+/*
+ * Start a thread for the worker in slot `wp', reaping whatever thread last
+ * served the slot.  That thread has already given up the slot, and has nothing
+ * left to do but return, so the join does not wait long.
+ */
+static bool
+worker_start(sched_t *sp, worker_t *wp)
+{
+	pthread_attr_t attr;
+	int rc;
+
+	if (wp->joinable) {
+		(void) pthread_join(wp->tid, NULL);
+		wp->joinable = false;
+	}
+
+	if (pthread_attr_init(&attr) != 0)
+		return (false);
+
+	if (sp->stack_size > 0)
+		(void) pthread_attr_setstacksize(&attr, sp->stack_size);
+
+	wp->running = true;
+	(void) atomic_fetch_add(&sp->live_workers, 1);
+
+	rc = pthread_create(&wp->tid, &attr, worker_func, (void *)wp);
+	(void) pthread_attr_destroy(&attr);
+
+	if (rc != 0) {
+		wp->running = false;
+		(void) atomic_fetch_sub(&sp->live_workers, 1);
+		return (false);
+	}
+
+	wp->joinable = true;
+	return (true);
+}
+
+/*
+ * Whether another worker should be started: nobody is free to take work, and
+ * fewer than `min_workers' are running, either because some are blocked or
+ * because a lazy scheduler has yet to start them all.  A lazy scheduler also
+ * waits until more than `lazy' tasks are outstanding for each thread running
+ * them, counting any caller of sched_execute() that is running them itself.
+ */
+static bool
+pool_short(sched_t *sp)
+{
+	int running = atomic_load(&sp->live_workers) -
+	    atomic_load(&sp->blocked_workers);
+
+	return (sp->state != SCHED_DONE &&
+	    atomic_load(&sp->idle_workers) == 0 &&
+	    atomic_load(&sp->spinning_workers) == 0 &&
+	    running < sp->min_workers && (sp->lazy == 0 ||
+	    atomic_load(&sp->pq.remaining_tasks) > (running +
+	    atomic_load(&sp->inline_runners)) * sp->lazy));
+}
+
+/*
+ * Work is waiting and there are too few workers to take it.  Start another, if
+ * the pool has room: one to stand in for a blocked worker, or as many as a lazy
+ * scheduler's backlog calls for.
+ */
+static void
+pool_grow(sched_t *sp)
+{
+	priority_queue_t *pq = &sp->pq;
+	int i;
+
+	(void) pthread_mutex_lock(&pq->lock);
+
+	for (i = 0; i < sp->num_workers && pool_short(sp); i++) {
+		if (sp->workers[i].running)
+			continue;
+
+		if (!worker_start(sp, &sp->workers[i]) || sp->lazy == 0)
+			break;
+	}
+
+	(void) pthread_mutex_unlock(&pq->lock);
+}
+
+static void
+pool_top_up(sched_t *sp)
+{
+	if (pool_short(sp))
+		pool_grow(sp);
+}
+
+static bool
+priority_queue_init(priority_queue_t *pq, size_t capacity)
+{
+	pthread_condattr_t attr;
+
+	assert(pq != NULL);
+
+	bzero(pq, sizeof (priority_queue_t));
+
+	if (pthread_cond_init(&pq->cv, NULL) != 0)
+		return (false);
+
+	if (pthread_cond_init(&pq->drain_cv, NULL) != 0) {
+		(void) pthread_cond_destroy(&pq->cv);
+		return (false);
+	}
+
+	/* Post timeouts are measured on the monotonic clock. */
+	if (pthread_condattr_init(&attr) != 0) {
+		(void) pthread_cond_destroy(&pq->cv);
+		(void) pthread_cond_destroy(&pq->drain_cv);
+		return (false);
+	}
+
+	(void) pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+	if (pthread_cond_init(&pq->space_cv, &attr) != 0) {
+		(void) pthread_condattr_destroy(&attr);
+		(void) pthread_cond_destroy(&pq->cv);
+		(void) pthread_cond_destroy(&pq->drain_cv);
+		return (false);
+	}
+
+	(void) pthread_condattr_destroy(&attr);
+
+	if (pthread_mutex_init(&pq->lock, NULL) != 0) {
+		(void) pthread_cond_destroy(&pq->cv);
+		(void) pthread_cond_destroy(&pq->drain_cv);
+		(void) pthread_cond_destroy(&pq->space_cv);
+		return (false);
+	}
+
+	if ((pq->heap = heap_create(capacity)) == NULL) {
+		(void) pthread_cond_destroy(&pq->cv);
+		(void) pthread_cond_destroy(&pq->drain_cv);
+		(void) pthread_cond_destroy(&pq->space_cv);
+		(void) pthread_mutex_destroy(&pq->lock);
+		return (false);
+	}
+
+	return (true);
+}
+
+static void
+priority_queue_destroy(priority_queue_t *pq)
+{
+	assert(pq != NULL);
+
+	(void) pthread_cond_destroy(&pq->cv);
+	(void) pthread_cond_destroy(&pq->drain_cv);
+	(void) pthread_cond_destroy(&pq->space_cv);
+	(void) pthread_mutex_destroy(&pq->lock);
+	heap_destroy(pq->heap);
+}
+
+static void
+workers_destroy(sched_t *sp, int count)
+{
+	int i;
+
+	if (sp->mode == SCHED_MODE_STEAL) {
+		for (i = 0; i < count; i++)
+			deque_destroy(&sp->workers[i].deque);
+	}
+
+	free(sp->workers);
+}
+
+static bool
+workers_init(sched_t *sp, const sched_attr_t *ap)
+{
+	int i;
+
+	if (ap->num_workers == 0) {
+		sp->workers = NULL;
+		return (true);
+	}
+
+	if ((sp->workers = aligned_alloc(SCHED_CACHE_LINE,
+	    sizeof (worker_t) * ap->num_workers)) == NULL)
+		return (false);
+
+	bzero(sp->workers, sizeof (worker_t) * ap->num_workers);
+
+	for (i = 0; i < ap->num_workers; i++) {
+		sp->workers[i].id = i;
+		sp->workers[i].sched = sp;
+		sp->workers[i].cpu = -1;
+		sp->workers[i].node = SCHED_NODE_ANY;
+		sp->workers[i].spin = sp->spin == SCHED_SPIN_ADAPTIVE ?
+		    SCHED_SPIN_MIN : sp->spin;
+	}
+
+	if (sp->mode == SCHED_MODE_STEAL) {
+		for (i = 0; i < ap->num_workers; i++) {
+			if (!deque_init(&sp->workers[i].deque,
+			    ap->queue_depth)) {
+				workers_destroy(sp, i);
+				return (false);
+			}
+		}
+	}
+
+	return (true);
+}
+
+/*
+ * Decide which CPU (or node) each worker will be pinned to.  The workers pin
+ * themselves once they start.
+ */
+static void
+place_workers(sched_t *sp, const sched_attr_t *ap)
+{
+	topology_t *tp = &sp->topo;
+	worker_t *wp;
+	int i, j, k, node;
+
+	for (i = 0; i < ap->num_workers; i++) {
+		wp = &sp->workers[i];
+
+		switch (ap->affinity) {
+		case SCHED_AFFINITY_CPUS:
+			wp->cpu = ap->cpus[i % ap->ncpus];
+			wp->node = topology_cpu_node(tp, wp->cpu);
+			break;
+		case SCHED_AFFINITY_COMPACT:
+			/* Walk the CPUs node by node, wrapping if need be. */
+			for (k = 0, j = 0; k < tp->num_nodes; k++)
+				j += tp->node_ncpus[k];
+
+			for (node = 0, j = i % j;
+			    j >= tp->node_ncpus[node]; node++)
+				j -= tp->node_ncpus[node];
+
+			wp->cpu = tp->node_cpus[node][j];
+			wp->node = node;
+			break;
+		case SCHED_AFFINITY_SCATTER:
+			node = i % tp->num_nodes;
+			wp->cpu = tp->node_cpus[node][(i / tp->num_nodes) %
+			    tp->node_ncpus[node]];
+			wp->node = node;
+			break;
+		case SCHED_AFFINITY_NODE:
+			wp->node = i % tp->num_nodes;
+			break;
+		default:
+			break;
+		}
+
+		if (wp->node < 0)
+			wp->node = SCHED_NODE_ANY;
+	}
+}
+
+static void
+placement_destroy(sched_t *sp)
+{
+	int i;
+
+	for (i = 0; i < sp->num_nodes; i++)
+		priority_queue_destroy(&sp->node_pq[i]);
+
+	free(sp->node_pq);
+
+	if (sp->affinity != SCHED_AFFINITY_NONE)
+		topology_destroy(&sp->topo);
+}
+
+static bool
+placement_init(sched_t *sp, const sched_attr_t *ap)
+{
+	int i;
+
+	sp->affinity = ap->affinity;
+
+	if (ap->affinity == SCHED_AFFINITY_NONE)
+		return (true);
+
+	if (ap->affinity == SCHED_AFFINITY_CPUS &&
+	    (ap->cpus == NULL || ap->ncpus <= 0))
+		return (false);
+
+	if (!topology_load(&sp->topo, ap->sysfs))
+		return (false);
+
+	place_workers(sp, ap);
+
+	if (!ap->numa)
+		return (true);
+
+	if ((sp->node_pq = malloc(sizeof (priority_queue_t) *
+	    sp->topo.num_nodes)) == NULL) {
+		topology_destroy(&sp->topo);
+		return (false);
+	}
+
+	for (i = 0; i < sp->topo.num_nodes; i++) {
+		if (!priority_queue_init(&sp->node_pq[i], ap->queue_depth)) {
+			placement_destroy(sp);
+			return (false);
+		}
+
+		sp->num_nodes++;
+	}
+
+	return (true);
+}
+
+static void
+qos_destroy(sched_t *sp)
+{
+	int i;
+
+	for (i = 0; i < sp->num_qos_pq; i++)
+		priority_queue_destroy(&sp->qos_pq[i]);
+
+	free(sp->qos_pq);
+}
+
+/*
+ * Under QoS, every class but the default gets a heap of its own.  Every class
+ * gets at least some share of the workers, however small its weight.
+ */
+static bool
+qos_init(sched_t *sp, const sched_attr_t *ap)
+{
+	int i;
+
+	if (ap->policy != SCHED_POLICY_QOS)
+		return (true);
+
+	for (i = 0; i < SCHED_QOS_CLASSES; i++) {
+		sp->qos_weight[i] = ap->qos_weight[i] > 0 ?
+		    ap->qos_weight[i] : 1;
+	}
+
+	atomic_init(&sp->qos_credit[0], sp->qos_weight[0]);
+
+	if ((sp->qos_pq = malloc(sizeof (priority_queue_t) *
+	    (SCHED_QOS_CLASSES - 1))) == NULL)
+		return (false);
+
+	for (i = 0; i < SCHED_QOS_CLASSES - 1; i++) {
+		if (!priority_queue_init(&sp->qos_pq[i], ap->queue_depth)) {
+			qos_destroy(sp);
+			return (false);
+		}
+
+		sp->num_qos_pq++;
+	}
+
+	return (true);
+}
+
+bool
+sched_init(sched_t *sp, int num_workers, int queue_depth)
+{
+	return (sched_init_mode(sp, num_workers, queue_depth,
+	    SCHED_MODE_SHARED));
+}
+
+bool
+sched_init_mode(sched_t *sp, int num_workers, int queue_depth,
+    sched_mode_t mode)
+{
+	sched_attr_t attr;
+
+	sched_attr_init(&attr, num_workers, queue_depth);
+	attr.mode = mode;
+	return (sched_init_attr(sp, &attr));
+}
+
+void
+sched_attr_init(sched_attr_t *ap, int num_workers, int queue_depth)
+{
+	assert(ap != NULL);
+
+	bzero(ap, sizeof (sched_attr_t));
+	ap->num_workers = num_workers;
+	ap->queue_depth = queue_depth;
+	ap->mode = SCHED_MODE_SHARED;
+	ap->affinity = SCHED_AFFINITY_NONE;
+	ap->spin = SCHED_SPIN_ADAPTIVE;
+	ap->max_workers = num_workers;
+	ap->idle_timeout = SCHED_IDLE_TIMEOUT;
+	ap->overflow = SCHED_OVERFLOW_REJECT;
+	ap->post_timeout = -1;
+	ap->policy = SCHED_POLICY_PRIORITY;
+	ap->pool_pri = SCHED_PRI_DEFAULT;
+	ap->qos_weight[SCHED_QOS_USER_INTERACTIVE] = 8;
+	ap->qos_weight[SCHED_QOS_DEFAULT] = 4;
+	ap->qos_weight[SCHED_QOS_UTILITY] = 2;
+	ap->qos_weight[SCHED_QOS_BACKGROUND] = 1;
+	ap->aging = SCHED_AGING;
+}
+
+bool
+sched_init_attr(sched_t *sp, const sched_attr_t *attr)
+{
+	sched_attr_t elastic, attached;
+	const sched_attr_t *ap = attr;
+	int i;
+
+	assert(sp != NULL && ap != NULL);
+
+	bzero(sp, sizeof (sched_t));
+
+	/*
+	 * An attached scheduler has no workers of its own, and nothing that
+	 * only makes sense for workers of its own.  As far as sharing out its
+	 * work goes, it has as many workers as it may take from the pool.
+	 */
+	if (ap->pool != NULL) {
+		attached = *ap;
+		attached.num_workers = attached.max_workers = 0;
+		attached.mode = SCHED_MODE_SHARED;
+		attached.affinity = SCHED_AFFINITY_NONE;
+		attached.numa = false;
+		attached.stats = false;
+		ap = &attached;
+
+		sp->pool = ap->pool;
+		sp->pool_pri = ap->pool_pri;
+		sp->weight = ap->weight > 0 ? ap->weight :
+		    ap->pool->num_workers;
+		atomic_init(&sp->live_workers, sp->weight);
+	}
+
+	sp->mode = ap->mode;
+	sp->spin = ap->spin;
+	sp->min_workers = ap->num_workers;
+	sp->idle_timeout = ap->idle_timeout;
+	sp->overflow = ap->overflow;
+	sp->max_queue_depth = ap->max_queue_depth;
+	sp->post_timeout = ap->post_timeout;
+	sp->policy = ap->policy;
+	sp->expire = ap->expire;
+	sp->lazy = ap->pool != NULL ? 0 : ap->lazy;
+	sp->aging = ap->aging;
+	sp->stack_size = ap->stack_size;
+
+	if (sp->stack_size > 0 && sp->stack_size < PTHREAD_STACK_MIN)
+		sp->stack_size = PTHREAD_STACK_MIN;
+
+	/*
+	 * An elastic pool has a slot for every worker it may grow to, but
+	 * only starts `num_workers' of them; everything from here on is sized
+	 * by the number of slots.
+	 */
+	if (ap->max_workers > ap->num_workers) {
+		elastic = *ap;
+		elastic.num_workers = ap->max_workers;
+		ap = &elastic;
+	}
+
+	/* With only the one CPU, spinning just keeps the poster off of it. */
+	if (sp->spin == SCHED_SPIN_ADAPTIVE &&
+	    sysconf(_SC_NPROCESSORS_ONLN) < 2)
+		sp->spin = 0;
+
+	if (!priority_queue_init(&sp->pq, ap->queue_depth))
+		return (false);
+
+	if (!ring_init(&sp->fifo, ap->queue_depth)) {
+		priority_queue_destroy(&sp->pq);
+		return (false);
+	}
+
+	if (!qos_init(sp, ap)) {
+		ring_destroy(&sp->fifo);
+		priority_queue_destroy(&sp->pq);
+		return (false);
+	}
+
+	if (!workers_init(sp, ap)) {
+		qos_destroy(sp);
+		ring_destroy(&sp->fifo);
+		priority_queue_destroy(&sp->pq);
+		return (false);
+	}
+
+	if (!placement_init(sp, ap)) {
+		workers_destroy(sp, ap->num_workers);
+		qos_destroy(sp);
+		ring_destroy(&sp->fifo);
+		priority_queue_destroy(&sp->pq);
+		return (false);
+	}
+
+	if (!sched_timers_init(sp)) {
+		placement_destroy(sp);
+		workers_destroy(sp, ap->num_workers);
+		qos_destroy(sp);
+		ring_destroy(&sp->fifo);
+		priority_queue_destroy(&sp->pq);
+		return (false);
+	}
+
+	if (!sched_stats_init(sp, ap)) {
+		sched_timers_fini(sp);
+		placement_destroy(sp);
+		workers_destroy(sp, ap->num_workers);
+		qos_destroy(sp);
+		ring_destroy(&sp->fifo);
+		priority_queue_destroy(&sp->pq);
+		return (false);
+	}
+
+	if (!sched_trace_init(sp, ap)) {
+		sched_stats_fini(sp);
+		sched_timers_fini(sp);
+		placement_destroy(sp);
+		workers_destroy(sp, ap->num_workers);
+		qos_destroy(sp);
+		ring_destroy(&sp->fifo);
+		priority_queue_destroy(&sp->pq);
+		return (false);
+	}
+
+	if (!sched_async_init(sp)) {
+		sched_trace_fini(sp);
+		sched_stats_fini(sp);
+		sched_timers_fini(sp);
+		placement_destroy(sp);
+		workers_destroy(sp, ap->num_workers);
+		qos_destroy(sp);
+		ring_destroy(&sp->fifo);
+		priority_queue_destroy(&sp->pq);
+		return (false);
+	}
+
+	sp->state = SCHED_STOPPED;
+	sp->num_workers = ap->num_workers;
+
+	/*
+	 * Everything a worker needs is in place before it starts, so there is
+	 * no need to hold the lock while they are created.  A lazy scheduler
+	 * leaves it to pool_grow().
+	 */
+	for (i = 0; i < sp->min_workers && sp->lazy == 0; i++)
+		(void) worker_start(sp, &sp->workers[i]);
+
+	return (true);
+}
+
+/*
+ * Make room in `pq' for `n' more tasks, as the overflow policy says.  Must be
+ * called with `pq->lock' held, which is dropped while waiting for room.  A
+ * stopped scheduler is started if a poster has to wait, since otherwise
+ * nothing would ever make room.
+ */
+static bool
+pq_reserve(sched_t *sp, priority_queue_t *pq, int n)
+{
+	heap_t *hp = pq->heap;
+	struct timespec deadline;
+	int size, rc = 0;
+
+	if (hp->capacity - hp->total >= n)
+		return (true);
+
+	if (sp->overflow == SCHED_OVERFLOW_GROW) {
+		for (size = hp->capacity > 0 ? hp->capacity : 1;
+		    size - hp->total < n; size *= 2)
+			continue;
+
+		if (sp->max_queue_depth > 0 && size > sp->max_queue_depth)
+			size = sp->max_queue_depth;
+
+		return (size - hp->total >= n && heap_resize(hp, size));
+	}
+
+	if (sp->overflow != SCHED_OVERFLOW_BLOCK || postnowait ||
+	    sched_current() == SCHED_HOST(sp) || n > hp->capacity)
+		return (false);
+
+	if (sp->post_timeout >= 0) {
+		(void) clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += sp->post_timeout / 1000;
+		deadline.tv_nsec += (sp->post_timeout % 1000) * 1000000;
+
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	/*
+	 * Nothing posted with `run_now' unset has woken a worker, so they may
+	 * all be asleep with a full queue.
+	 */
+	if (pq != &sp->pq)
+		(void) pthread_mutex_lock(&sp->pq.lock);
+
+	if (sp->state == SCHED_STOPPED)
+		sp->state = SCHED_RUNNING;
+
+	(void) pthread_cond_broadcast(&sp->pq.cv);
+
+	if (pq != &sp->pq)
+		(void) pthread_mutex_unlock(&sp->pq.lock);
+
+	/* An attached scheduler's queue is only drained by its pumps. */
+	if (sp->pool != NULL) {
+		(void) pthread_mutex_unlock(&pq->lock);
+		pool_kick(sp);
+		(void) pthread_mutex_lock(&pq->lock);
+	}
+
+	pq->producers++;
+
+	while (hp->capacity - hp->total < n && sp->state != SCHED_DONE &&
+	    rc != ETIMEDOUT) {
+		if (sp->post_timeout < 0)
+			(void) pthread_cond_wait(&pq->space_cv, &pq->lock);
+		else
+			rc = pthread_cond_timedwait(&pq->space_cv, &pq->lock,
+			    &deadline);
+	}
+
+	pq->producers--;
+
+	return (hp->capacity - hp->total >= n && sp->state != SCHED_DONE);
+}
+
+/*
+ * Called after a task has been queued somewhere other than the shared heap.
+ * The lock is only needed if `run_now' has to start a stopped scheduler.
+ */
+static void
+start_or_wake(sched_t *sp, bool run_now)
+{
+	priority_queue_t *pq = &sp->pq;
+
+	if (run_now && sp->state == SCHED_STOPPED) {
+		(void) pthread_mutex_lock(&pq->lock);
+
+		if (sp->state == SCHED_STOPPED)
+			sp->state = SCHED_RUNNING;
+
+		(void) pthread_cond_broadcast(&pq->cv);
+		(void) pthread_mutex_unlock(&pq->lock);
+
+		if (sp->pool == NULL)
+			return;
+	}
+
+	wake_worker(sp);
+}
+
+/*
+ * Whether the calling thread is one of this scheduler's workers, and so can
+ * post straight on to its own deque.
+ */
+static bool
+posting_locally(sched_t *sp)
+{
+	return (sp->mode == SCHED_MODE_STEAL && worker_index(sp) >= 0);
+}
+
+/*
+ * A task with a node hint goes on to that node's queue, where workers running
+ * on the node will find it first.  Under QoS, a task of any class but the
+ * default goes on to its class's queue.  Either way, only that queue's lock is
+ * taken.
+ */
+static bool
+sched_post_to(sched_t *sp, priority_queue_t *pq, task_t *tp, bool run_now)
+{
+	heap_elem_t elem;
+
+	(void) atomic_fetch_add(&sp->pq.remaining_tasks, 1);
+	(void) pthread_mutex_lock(&pq->lock);
+
+	if (!pq_reserve(sp, pq, 1)) {
+		(void) pthread_mutex_unlock(&pq->lock);
+		sched_tasks_done(sp, 1);
+		return (false);
+	}
+
+	elem.val = task_key(sp, tp);
+	elem.meta = tp;
+	elem.index = &tp->heap_index;
+	tp->pq = pq;
+	task_posted(sp, tp);
+	(void) heap_insert(pq->heap, elem);
+	pq_update_top(pq);
+	(void) pthread_mutex_unlock(&pq->lock);
+
+	start_or_wake(sp, run_now);
+	return (true);
+}
+
+/*
+ * A task posted from one of our own workers in SCHED_MODE_STEAL goes on to
+ * that worker's deque without touching the shared lock, unless it has asked
+ * for a different NUMA node.  Idle workers are only woken if there are any.
+ */
+static bool
+sched_post_local(sched_t *sp, task_t *tp)
 {
-	heap_elem_t elem;
+	priority_queue_t *pq = &sp->pq;
 
-	assert(hp != NULL);
+	(void) atomic_fetch_add(&pq->remaining_tasks, 1);
+	task_posted(sp, tp);
 
-	if (heap_remove(hp, &elem))
-		return (elem.meta);
+	if (!deque_push(&curworker->deque, tp)) {
+		sched_tasks_done(sp, 1);
+		return (false);
+	}
 
-	return (NULL);
+	STATS_MAX(STATS_WORKER(sp, curworker->id), deque_hwm,
+	    atomic_load(&curworker->deque.bottom) -
+	    atomic_load(&curworker->deque.top));
+
+	wake_worker(sp);
+	return (true);
 }
 
-void
-task_init(task_t *tp, uint64_t pri, void (*fptr)(void *, int), void *args)
+bool
+sched_post(sched_t *sp, task_t *tp, bool run_now)
 {
-	assert(tp != NULL);
+	priority_queue_t *pq;
+	heap_elem_t elem;
+	int node;
 
-	bzero(tp, sizeof (task_t));
-	tp->pri = pri;
-	tp->fptr = fptr;
-	tp->args = args;
-}
+	assert(sp != NULL && tp != NULL);
 
-static int
-get_thread_index(sched_t *sp)
-{
-	int i;
-	int index = -1;
-	pthread_t tid = pthread_self();
+	node = sp->num_nodes > 0 && tp->node >= 0 ?
+	    topology_node_index(&sp->topo, tp->node) : -1;
 
-	assert(sp != NULL);
+	if (posting_locally(sp) && (node < 0 || node == curworker->node))
+		return (sched_post_local(sp, tp));
 
-	(void) pthread_mutex_lock(&sp->pq.lock);
+	if (node >= 0)
+		return (sched_post_to(sp, &sp->node_pq[node], tp, run_now));
 
-	for (i = 0; i < sp->num_workers; i++) {
-		if (pthread_equal(sp->workers[i], tid) != 0) {
-			index = i;
-			break;
-		}
+	if ((pq = qos_queue(sp, tp->qos)) != &sp->pq)
+		return (sched_post_to(sp, pq, tp, run_now));
+
+	(void) pthread_mutex_lock(&pq->lock);
+
+	if (!pq_reserve(sp, pq, 1)) {
+		(void) pthread_mutex_unlock(&pq->lock);
+		return (false);
 	}
 
-	(void) pthread_mutex_unlock(&sp->pq.lock);
+	elem.val = task_key(sp, tp);
+	elem.meta = tp;
+	elem.index = &tp->heap_index;
+	tp->pq = pq;
+	task_posted(sp, tp);
+	(void) heap_insert(pq->heap, elem);
+	pq_update_top(pq);
+
+	pq->remaining_tasks++;
 
-	return (index);
-}
+	/*
+	 * A spinning worker will notice the task without being woken, and the
+	 * wakeup is the expensive part of posting.
+	 */
+	if (run_now) {
+		sp->state = SCHED_RUNNING;
 
-static void
-process_task(task_t *tp, int thread_num)
-{
-	assert(tp != NULL);
+		if (atomic_load(&sp->spinning_workers) == 0)
+			(void) pthread_cond_signal(&pq->cv);
+	}
 
-	tp->fptr(tp->args, thread_num);
+	(void) pthread_mutex_unlock(&pq->lock);
+
+	if (sp->pool != NULL)
+		pool_kick(sp);
+	else if (run_now)
+		pool_top_up(sp);
+
+	return (true);
 }
 
-static void *
-worker_func(void *arg)
+/*
+ * Post `n' tasks while only taking the lock once.  Either all of the tasks are
+ * posted or, if there is not enough room in the queue, none of them are.  The
+ * whole batch goes to the shared heap; node hints and QoS classes are not
+ * consulted.
+ */
+bool
+sched_post_batch(sched_t *sp, task_t **tpp, int n, bool run_now)
 {
-	sched_t *sp = arg;
 	priority_queue_t *pq;
-	heap_t *hp;
-	heap_elem_t elem;
-	task_t *task;
-	int thread_num;
+	heap_elem_t stack_elems[SCHED_BATCH_STACK];
+	heap_elem_t *elems = stack_elems;
+	bool ret = false;
+	int i;
 
-	assert(sp != NULL);
+	assert(sp != NULL && (tpp != NULL || n == 0));
 
 	pq = &sp->pq;
-	hp = pq->heap;
-
-	/*
-	 * Under normal circumstances, it does not matter what thread does the
-	 * work as long as it gets done, but there may be circumstances where
-	 * we want certain workers to always process the same part of a given
-	 * problem.  Such examples include, but are not limited to parallel
-	 * compression over a network.  Knowing the index of this thread in
-	 * our table of workers will allow applications to do things like direct
-	 * the nth worker at the nth chunk of a block that all threads have
-	 * access to.
-	 */
-	thread_num = get_thread_index(sp);
 
-	assert(thread_num >= 0);
+	if (posting_locally(sp)) {
+		(void) atomic_fetch_add(&pq->remaining_tasks, n);
 
-	for (;;) {
-		(void) pthread_mutex_lock(&pq->lock);
+		for (i = 0; i < n; i++) {
+			task_posted(sp, tpp[i]);
 
-		/*
-		 * If the heap is empty, and the `done' latch has been set,
-		 * then no more work is coming.  This worker is free to exit.
-		 */
-		if (sp->state == SCHED_DONE && heap_empty(hp)) {
-			(void) pthread_mutex_unlock(&pq->lock);
-			break;
+			if (!deque_push(&curworker->deque, tpp[i])) {
+				sched_tasks_done(sp, n - i);
+				break;
+			}
 		}
 
-		/*
-		 * If the heap is empty and the scheduler is still running, then
-		 * more work will eventualy come.  Wait on the cv until we
-		 * receive a signal.
-		 */
-		if (heap_empty(hp) || sp->state == SCHED_STOPPED)
-			(void) pthread_cond_wait(&pq->cv, &pq->lock);
+		wake_worker(sp);
+		return (i == n);
+	}
 
-		task = get_next_task(hp);
-		(void) pthread_mutex_unlock(&pq->lock);
+	if (n > SCHED_BATCH_STACK &&
+	    (elems = malloc(sizeof (heap_elem_t) * n)) == NULL)
+		return (false);
 
-		/*
-		 * There is no gaurantee that we will have work to do.
-		 * Another thread may have beat us to get whatever the next
-		 * task is, leaving the queue empty.  If that's the case, we
-		 * will just basically go back to sleep when we resume the
-		 * loop (above).
-		 */
-		if (task != NULL) {
-			process_task(task, thread_num);
+	for (i = 0; i < n; i++) {
+		elems[i].val = task_key(sp, tpp[i]);
+		elems[i].meta = tpp[i];
+		elems[i].index = &tpp[i]->heap_index;
+		tpp[i]->pq = pq;
+	}
+
+	(void) pthread_mutex_lock(&pq->lock);
 
-			(void) pthread_mutex_lock(&pq->lock);
+	if (pq_reserve(sp, pq, n)) {
+		for (i = 0; i < n; i++)
+			task_posted(sp, tpp[i]);
 
-			if (--pq->remaining_tasks == 0)
-				(void) pthread_cond_broadcast(&pq->cv);
+		(void) heap_insert_batch(pq->heap, elems, n);
+		pq_update_top(pq);
+		pq->remaining_tasks += n;
+		ret = true;
 
-			(void) pthread_mutex_unlock(&pq->lock);
+		if (run_now) {
+			sp->state = SCHED_RUNNING;
+			(void) pthread_cond_broadcast(&pq->cv);
 		}
 	}
 
-	return (NULL);
+	(void) pthread_mutex_unlock(&pq->lock);
+
+	if (ret && sp->pool != NULL)
+		pool_kick(sp);
+	else if (ret && run_now)
+		pool_top_up(sp);
+
+	if (elems != stack_elems)
+		free(elems);
+
+	return (ret);
 }
 
+/*
+ * Whether `pq' is one of `sp's heaps.
+ */
 static bool
-priority_queue_init(priority_queue_t *pq, size_t capacity)
+pq_owned(sched_t *sp, priority_queue_t *pq)
 {
-	assert(pq != NULL);
+	return (pq == &sp->pq || (pq >= sp->node_pq &&
+	    pq < sp->node_pq + sp->num_nodes) || (pq >= sp->qos_pq &&
+	    pq < sp->qos_pq + sp->num_qos_pq));
+}
 
-	bzero(pq, sizeof (priority_queue_t));
+/*
+ * Take `tp' back off of the queue before it has run.  As far as everyone else
+ * is concerned it is done: sched_execute() and its group stop waiting for it,
+ * and any tasks posted to run after it are released.  Only a task that is
+ * still sitting in one of the heaps can be cancelled; one that a worker has
+ * already taken, or that went to a worker's deque, the FIFO lane or a serial
+ * queue, cannot.  Returns whether the task was cancelled.
+ */
+bool
+sched_cancel(sched_t *sp, task_t *tp)
+{
+	priority_queue_t *pq;
+	sched_group_t *group;
+	heap_elem_t elem;
+	bool ret;
 
-	if (pthread_cond_init(&pq->cv, NULL) != 0)
-		return (false);
+	assert(sp != NULL && tp != NULL);
 
-	if (pthread_mutex_init(&pq->lock, NULL) != 0) {
-		(void) pthread_cond_destroy(&pq->cv);
+	if ((pq = tp->pq) == NULL || !pq_owned(sp, pq))
 		return (false);
+
+	(void) pthread_mutex_lock(&pq->lock);
+
+	if ((ret = heap_delete(pq->heap, tp->heap_index, &elem))) {
+		pq_update_top(pq);
+
+		if (pq->producers > 0)
+			(void) pthread_cond_broadcast(&pq->space_cv);
 	}
 
-	if ((pq->heap = heap_create(capacity)) == NULL) {
-		(void) pthread_cond_destroy(&pq->cv);
-		(void) pthread_mutex_destroy(&pq->lock);
+	(void) pthread_mutex_unlock(&pq->lock);
+
+	if (!ret)
 		return (false);
-	}
 
+	assert(elem.meta == tp);
+	group = tp->group;
+	release_successors(take_successors(tp));
+
+	if (group != NULL)
+		sched_group_leave(group);
+
+	sched_tasks_done(sp, 1);
 	return (true);
 }
 
-static void
-priority_queue_destroy(priority_queue_t *pq)
+/*
+ * Move a queued task to priority `pri', behind any others already queued at
+ * that priority.  Like sched_cancel(), this only works on a task that is still
+ * in one of the heaps, and returns whether it did.  Under EDF the priority is
+ * recorded, but the task stays where its deadline puts it.  Under QoS, the
+ * time it has already waited still counts.
+ */
+bool
+sched_reprioritize(sched_t *sp, task_t *tp, uint64_t pri)
 {
-	assert(pq != NULL);
+	priority_queue_t *pq;
+	uint64_t key;
+	bool ret;
 
-	(void) pthread_cond_destroy(&pq->cv);
-	(void) pthread_mutex_destroy(&pq->lock);
-	heap_destroy(pq->heap);
+	assert(sp != NULL && tp != NULL);
+
+	if ((pq = tp->pq) == NULL || !pq_owned(sp, pq))
+		return (false);
+
+	(void) pthread_mutex_lock(&pq->lock);
+
+	if (sp->policy == SCHED_POLICY_EDF || tp->heap_index < 0) {
+		if ((ret = tp->heap_index >= 0))
+			tp->pri = pri;
+	} else {
+		key = pri;
+
+		if (sp->policy == SCHED_POLICY_QOS)
+			key = pq->heap->data[tp->heap_index].val -
+			    qos_bias(sp, tp->pri) + qos_bias(sp, pri);
+
+		if ((ret = heap_update(pq->heap, tp->heap_index, key))) {
+			tp->pri = pri;
+			pq_update_top(pq);
+		}
+	}
+
+	(void) pthread_mutex_unlock(&pq->lock);
+	return (ret);
 }
 
+/*
+ * Post a task that will not become runnable until every task in `deps' has
+ * finished.  Each dependency gets an edge on its `succ' list; whichever
+ * predecessor finishes last posts the task, so pipelines can flow without a
+ * sched_execute() barrier between stages.  The dependencies must have been
+ * initialized with task_init() and must not have started to run yet.  One
+ * that has already run counts as done, until it is posted again.  `run_now'
+ * is passed on to sched_post() once the task is runnable.
+ */
 bool
-sched_init(sched_t *sp, int num_workers, int queue_depth)
+sched_post_after(sched_t *sp, task_t *tp, task_t **deps, int ndeps,
+    bool run_now)
 {
+	task_edge_t *ep, *head;
 	int i;
+	int satisfied = 1;
 
-	assert(sp != NULL);
+	assert(sp != NULL && tp != NULL && (deps != NULL || ndeps == 0));
 
-	bzero(sp, sizeof (sched_t));
+	if (ndeps == 0)
+		return (sched_post(sp, tp, run_now));
 
-	if (!priority_queue_init(&sp->pq, queue_depth))
+	if ((tp->edges = malloc(sizeof (task_edge_t) * ndeps)) == NULL)
 		return (false);
 
-	if ((sp->workers = malloc(sizeof (pthread_t) * num_workers)) == NULL) {
-		priority_queue_destroy(&sp->pq);
-		return (false);
-	}
+	tp->post_sched = sp;
 
-	sp->state = SCHED_STOPPED;
+	if (run_now)
+		tp->flags |= TASK_RUN_NOW;
+
+	(void) atomic_fetch_add(&sp->pq.remaining_tasks, 1);
+
+	/*
+	 * The extra count keeps the task from firing while we are still adding
+	 * edges; it is dropped along with any that were already satisfied.
+	 */
+	atomic_store(&tp->deps_left, ndeps + 1);
+
+	for (i = 0; i < ndeps; i++) {
+		assert(!(deps[i]->flags & TASK_DETACHED));
 
-	(void) pthread_mutex_lock(&sp->pq.lock);
+		ep = &tp->edges[i];
+		ep->task = tp;
+		head = atomic_load(&deps[i]->succ);
 
-	for (i = 0; i < num_workers; i++) {
-		(void) pthread_create(&sp->workers[i], NULL, worker_func,
-		    (void *)sp);
+		do {
+			if (head == &task_started) {
+				satisfied++;
+				break;
+			}
+
+			ep->next = head;
+		} while (!atomic_compare_exchange_weak(&deps[i]->succ, &head,
+		    ep));
 	}
 
-	sp->num_workers = num_workers;
-	(void) pthread_mutex_unlock(&sp->pq.lock);
+	if (atomic_fetch_sub(&tp->deps_left, satisfied) == satisfied)
+		task_runnable(tp);
 
 	return (true);
 }
 
+/*
+ * Post a task to the FIFO lane.  This never takes `pq->lock' unless there is
+ * an idle worker that needs waking, or `run_now' has to start a stopped
+ * scheduler.  Returns false if the lane is full.
+ */
 bool
-sched_post(sched_t *sp, task_t *tp, bool run_now)
+sched_post_fifo(sched_t *sp, task_t *tp, bool run_now)
 {
 	priority_queue_t *pq;
-	heap_elem_t elem;
 
 	assert(sp != NULL && tp != NULL);
 
 	pq = &sp->pq;
 
-	(void) pthread_mutex_lock(&pq->lock);
-
-	if (heap_full(pq->heap)) {
-		(void) pthread_mutex_unlock(&pq->lock);
-		return (false);
-	}
-
-	elem.val = tp->pri;
-	elem.meta = tp;
-	(void) heap_insert(pq->heap, elem);
+	(void) atomic_fetch_add(&pq->remaining_tasks, 1);
 
-	pq->remaining_tasks++;
+	task_posted(sp, tp);
 
-	if (run_now) {
-		sp->state = SCHED_RUNNING;
-		(void) pthread_cond_signal(&pq->cv);
+	if (!ring_enqueue(&sp->fifo, tp)) {
+		sched_tasks_done(sp, 1);
+		return (false);
 	}
 
-	(void) pthread_mutex_unlock(&pq->lock);
+	start_or_wake(sp, run_now);
 	return (true);
 }
 
@@ -245,22 +2183,63 @@ sched_post(sched_t *sp, task_t *tp, bool run_now)
  * If the task queue gets full, it may be necessary to either call this function
  * to clear it out in order to make room, _or_ call sched_post() where the
  * third argument is set to true indicating that the scheduler should get to
- * work if it isn't already.
+ * work if it isn't already.  A task must not call this on its own scheduler,
+ * since it would be waiting for itself to finish; sched_sync() is for that.
  */
 void
 sched_execute(sched_t *sp)
 {
 	priority_queue_t *pq;
+	task_t *tasks[SCHED_BATCH];
+	int i, n;
 
-	assert(sp != NULL);
+	assert(sp != NULL && sched_current() != sp);
 
 	pq = &sp->pq;
 	(void) pthread_mutex_lock(&pq->lock);
 	sp->state = SCHED_RUNNING;
 	(void) pthread_cond_broadcast(&pq->cv);
 
+	if (sp->pool != NULL) {
+		(void) pthread_mutex_unlock(&pq->lock);
+
+		for (i = 0; i < sp->weight; i++)
+			pool_kick(sp);
+
+		(void) pthread_mutex_lock(&pq->lock);
+	}
+
+	/*
+	 * Rather than just wait, the caller of a lazy scheduler runs tasks
+	 * itself for as long as there are any, starting workers as they back
+	 * up.  That way a short burst of work needs no threads at all.
+	 */
+	if (sp->lazy > 0) {
+		sched_t *outer = curinline;
+
+		(void) atomic_fetch_add(&sp->inline_runners, 1);
+		(void) pthread_mutex_unlock(&pq->lock);
+		curinline = sp;
+
+		do {
+			pool_top_up(sp);
+
+			if ((n = shared_next_tasks(sp, -1, tasks)) == 0)
+				break;
+
+			for (i = 0; i < n; i++)
+				worker_run(sp, NULL, tasks[i], -1);
+
+			sched_tasks_done(sp, n);
+		} while (n > 0);
+
+		curinline = outer;
+		(void) atomic_fetch_sub(&sp->inline_runners, 1);
+		(void) pthread_mutex_lock(&pq->lock);
+	}
+
 	while (pq->remaining_tasks > 0)
-		(void) pthread_cond_wait(&pq->cv, &pq->lock);
+		(void) pthread_cond_wait(&pq->drain_cv, &pq->lock);
 
 	sp->state = SCHED_STOPPED;
 	(void) pthread_mutex_unlock(&pq->lock);
@@ -280,11 +2259,148 @@ sched_fini(sched_t *sp)
 	(void) pthread_mutex_lock(&pq->lock);
 	sp->state = SCHED_DONE;
 	(void) pthread_cond_broadcast(&pq->cv);
+	(void) pthread_cond_broadcast(&pq->space_cv);
 	(void) pthread_mutex_unlock(&pq->lock);
 
-	for (i = 0; i < sp->num_workers; i++)
-		(void) pthread_join(sp->workers[i], NULL);
+	/*
+	 * Like workers, pumps run whatever is still queued before they let go
+	 * of us.
+	 */
+	if (sp->pool != NULL) {
+		for (i = 0; i < sp->weight; i++)
+			pool_kick(sp);
+
+		(void) pthread_mutex_lock(&pq->lock);
+
+		while (atomic_load(&sp->pumps) > 0)
+			(void) pthread_cond_wait(&pq->drain_cv, &pq->lock);
+
+		(void) pthread_mutex_unlock(&pq->lock);
+	}
+
+	/* Posters waiting on a node's or a class's queue give up too. */
+	for (i = 0; i < sp->num_nodes; i++) {
+		(void) pthread_mutex_lock(&sp->node_pq[i].lock);
+		(void) pthread_cond_broadcast(&sp->node_pq[i].space_cv);
+		(void) pthread_mutex_unlock(&sp->node_pq[i].lock);
+	}
+
+	for (i = 0; i < sp->num_qos_pq; i++) {
+		(void) pthread_mutex_lock(&sp->qos_pq[i].lock);
+		(void) pthread_cond_broadcast(&sp->qos_pq[i].space_cv);
+		(void) pthread_mutex_unlock(&sp->qos_pq[i].lock);
+	}
+
+	for (i = 0; i < sp->num_workers; i++) {
+		if (sp->workers[i].joinable)
+			(void) pthread_join(sp->workers[i].tid, NULL);
+	}
 
+	sched_timers_fini(sp);
+	sched_stats_fini(sp);
+	sched_trace_fini(sp);
+	sched_async_fini(sp);
+	placement_destroy(sp);
+	qos_destroy(sp);
 	priority_queue_destroy(&sp->pq);
-	free(sp->workers);
+	ring_destroy(&sp->fifo);
+	workers_destroy(sp, sp->num_workers);
+}
+
+/*
+ * Tell the scheduler that the calling task is about to block, typically on
+ * I/O, and will not be using its worker's CPU until sched_block_end().  If
+ * that leaves work waiting with fewer than `num_workers' workers to run it, an
+ * elastic pool starts another worker to make up for it.  A thread running a
+ * lazy scheduler's tasks from within sched_execute() counts as one of its
+ * workers here, and stops counting as running them until it is done
+ * blocking, so that whatever it waits for gets a worker of its own.  Both are
+ * no-ops when called from anywhere else.
+ */
+void
+sched_block_begin(void)
+{
+	sched_t *sp;
+
+	if (curworker == NULL) {
+		if ((sp = curinline) != NULL) {
+			(void) atomic_fetch_sub(&sp->inline_runners, 1);
+			pool_top_up(sp);
+		}
+
+		return;
+	}
+
+	sp = curworker->sched;
+	(void) atomic_fetch_add(&sp->blocked_workers, 1);
+
+	if (work_hint(sp))
+		pool_grow(sp);
+}
+
+void
+sched_block_end(void)
+{
+	if (curworker != NULL)
+		(void) atomic_fetch_sub(&curworker->sched->blocked_workers, 1);
+	else if (curinline != NULL)
+		(void) atomic_fetch_add(&curinline->inline_runners, 1);
+}
+
+/*
+ * The index of the worker the calling thread is running as, which is the same
+ * `thread_num' its tasks are handed, or -1 if it is not a worker.
+ */
+int
+sched_current_worker(void)
+{
+	return (curworker != NULL ? curworker->id : -1);
+}
+
+/*
+ * The scheduler the calling thread is a worker for, if any.
+ */
+sched_t *
+sched_current(void)
+{
+	return (curworker != NULL ? curworker->sched : NULL);
+}
+
+/*
+ * The per-worker user data slots for worker `index'.  There are
+ * SCHED_WORKER_SLOTS of them, and they sit on a cache line of their own.
+ */
+void **
+sched_worker_slots(sched_t *sp, int index)
+{
+	assert(sp != NULL && index >= 0 && index < sp->num_workers);
+
+	return (sp->workers[index].data);
+}
+
+static sched_t global_pool;
+static pthread_once_t global_once = PTHREAD_ONCE_INIT;
+static bool global_ready;
+
+static void
+global_init(void)
+{
+	sched_attr_t attr;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	sched_attr_init(&attr, ncpus < 1 ? 1 : (int)ncpus, SCHED_GLOBAL_DEPTH);
+	attr.overflow = SCHED_OVERFLOW_GROW;
+	global_ready = sched_init_attr(&global_pool, &attr);
+}
+
+/*
+ * The process-wide pool, created the first time it is asked for.  It is never
+ * torn down.  Returns NULL if it could not be created.
+ */
+sched_t *
+sched_global(void)
+{
+	(void) pthread_once(&global_once, global_init);
+
+	return (global_ready ? &global_pool : NULL);
 }
@@ -7,18 +7,101 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <assert.h>
 
 #include "heap.h"
+#include "deque.h"
+#include "ring.h"
+#include "topology.h"
+#include "wheel.h"
 
+/*
+ * Statistics can be compiled out entirely by building everything with
+ * -DSCHED_STATS=0, in which case sched_stats() always fails.  Otherwise they
+ * are only collected by schedulers that ask for them; see sched_attr_t.
+ */
+#ifndef	SCHED_STATS
+#define	SCHED_STATS	1
+#endif
+
+/* Likewise for tracing; see sched_trace_dump(). */
+#ifndef	SCHED_TRACE
+#define	SCHED_TRACE	1
+#endif
+
+/*
+ * Tasks posted with sched_post_fifo() bypass the heap and run in the order
+ * they were posted, as though they all had this priority.
+ */
+#define	SCHED_PRI_DEFAULT	1
+
+/* A task with this node hint may run anywhere. */
+#define	SCHED_NODE_ANY		(-1)
+
+/*
+ * Quality of service classes, as in GCD, for schedulers using
+ * SCHED_POLICY_QOS.  The default class comes first so that a task that is
+ * never given one by task_set_qos() lands in it.
+ */
+typedef enum sched_qos {
+	SCHED_QOS_DEFAULT,
+	SCHED_QOS_USER_INTERACTIVE,
+	SCHED_QOS_UTILITY,
+	SCHED_QOS_BACKGROUND,
+	SCHED_QOS_CLASSES
+} sched_qos_t;
+
+/*
+ * Task flags.  A detached task may free (or reuse) its own memory from within
+ * its function, so the scheduler never touches it once it has run.  Detached
+ * tasks cannot be used as dependencies.
+ */
+#define	TASK_DETACHED		0x1
+
+struct sched;
+struct sched_group;
+struct task_edge;
+struct priority_queue;
 
 typedef struct task {
 	uint64_t pri;
 	void (*fptr)(void *, int);
 	void *args;
+	struct sched_group *group;	/* Its group, if any. */
+	struct sched *post_sched;	/* Where a deferred task is posted. */
+	struct task *next;		/* Used to chain tasks on lists. */
+	atomic_int deps_left;		/* Unfinished predecessors. */
+	struct task_edge *edges;	/* Our edges, freed once runnable. */
+	_Atomic(struct task_edge *) succ; /* Tasks waiting on this one. */
+	int node;			/* Preferred NUMA node. */
+	uint32_t flags;
+	wheel_entry_t timer;		/* Used by sched_post_delayed(). */
+	uint64_t posted;		/* When it was queued, for stats. */
+	const char *name;		/* For traces; must outlive them. */
+	uint64_t deadline;		/* When it should be done by, or 0. */
+	uint64_t cost;			/* How long it expects to run, in ns. */
+	uint64_t expires;		/* When to give up on it, or 0. */
+	struct priority_queue *pq;	/* Heap it was last posted to. */
+	int heap_index;			/* Where it is in `pq', or -1. */
+	sched_qos_t qos;
 } task_t;
 
+/*
+ * An edge in the dependency graph.  It lives on the predecessor's `succ' list
+ * and points at the task that is waiting on it.
+ */
+typedef struct task_edge {
+	task_t *task;
+	struct task_edge *next;
+} task_edge_t;
+
 void task_init(task_t *, uint64_t, void (*fptr)(void *, int), void *);
+void task_set_node(task_t *, int);
+void task_set_name(task_t *, const char *);
+void task_set_deadline(task_t *, uint64_t, uint64_t);
+void task_set_expiry(task_t *, uint64_t);
+void task_set_qos(task_t *, sched_qos_t);
 
 typedef enum sched_state {
 	SCHED_STOPPED,	/* Tasks can be posted, but will not be processed. */
@@ -26,23 +109,431 @@ typedef enum sched_state {
 	SCHED_DONE	/* Used to tell all workers to exit. */
 } sched_state_t;
 
+typedef enum sched_mode {
+	SCHED_MODE_SHARED,	/* All workers share one priority queue. */
+	SCHED_MODE_STEAL	/* Per-worker deques with work stealing. */
+} sched_mode_t;
+
+/*
+ * What orders the heaps: priority, lowest `pri' first, or earliest deadline
+ * first.  Under EDF, tasks that can no longer finish by their deadline are
+ * moved behind those that still can, and tasks without a deadline come last.
+ *
+ * Under QoS, each class has a heap of its own, and workers share themselves
+ * out between the classes that have work by deficit round-robin: in every
+ * round, a class gets to run `qos_weight' tasks, so however busy the others
+ * are, background work keeps making progress.  Within a class, tasks go by
+ * priority, but waiting makes up for it: a unit of `pri' is only worth `aging'
+ * ns, so a task that has waited that long for each unit is ahead of any task
+ * of priority 0 that is posted after it.
+ */
+typedef enum sched_policy {
+	SCHED_POLICY_PRIORITY,
+	SCHED_POLICY_EDF,
+	SCHED_POLICY_QOS
+} sched_policy_t;
+
+typedef enum sched_affinity {
+	SCHED_AFFINITY_NONE,	/* Let the kernel place workers. */
+	SCHED_AFFINITY_CPUS,	/* One CPU each, round-robin over `cpus'. */
+	SCHED_AFFINITY_COMPACT,	/* One CPU each, filling a node at a time. */
+	SCHED_AFFINITY_SCATTER,	/* One CPU each, round-robin over nodes. */
+	SCHED_AFFINITY_NODE	/* Any CPU of a node, round-robin over nodes. */
+} sched_affinity_t;
+
+/*
+ * What posting to a full queue does.  By default the post just fails.  A
+ * growing queue doubles in size, up to `max_queue_depth' if that is set.  A
+ * blocking queue makes the poster wait for workers to make room, for up to
+ * `post_timeout' ms, or indefinitely if that is negative.  Workers themselves
+ * never wait, since they may be what would have to make the room, so their
+ * posts fail instead.  These apply to the heaps, not to the FIFO lane or the
+ * per-worker deques.
+ */
+typedef enum sched_overflow {
+	SCHED_OVERFLOW_REJECT,
+	SCHED_OVERFLOW_GROW,
+	SCHED_OVERFLOW_BLOCK
+} sched_overflow_t;
+
+/*
+ * How long an idle worker spins, watching for work, before it parks on the
+ * condition variable: a fixed number of rounds, each pausing twice as long as
+ * the last, or SCHED_SPIN_ADAPTIVE to let each worker tune its own budget by
+ * how often spinning pays off.  Zero parks straight away.
+ */
+#define	SCHED_SPIN_ADAPTIVE	(-1)
+
+/*
+ * Called in place of a task's own function when it has expired; see
+ * task_set_expiry().  As far as the scheduler is concerned the task is then
+ * done.
+ */
+typedef void (*sched_expire_fn_t)(task_t *, int);
+
+/* How long, in ms, an extra worker of an elastic pool idles before retiring. */
+#define	SCHED_IDLE_TIMEOUT	1000
+
+/* How many ns of waiting a unit of `pri' is worth under SCHED_POLICY_QOS. */
+#define	SCHED_AGING		1000000
+
+/*
+ * Extended configuration for sched_init_attr().  Start from sched_attr_init()
+ * so that new fields pick up sensible defaults.
+ */
+typedef struct sched_attr {
+	int num_workers;
+	int queue_depth;
+	sched_mode_t mode;
+	sched_affinity_t affinity;
+	const int *cpus;	/* CPU list for SCHED_AFFINITY_CPUS. */
+	int ncpus;
+	bool numa;		/* Keep a task queue per NUMA node. */
+	const char *sysfs;	/* Where to read topology; NULL for /sys. */
+	int spin;		/* Spin rounds before parking. */
+	int max_workers;	/* Most workers; see sched_block_begin(). */
+	int idle_timeout;	/* Retire extra workers after this many ms. */
+	bool stats;		/* Collect statistics; see sched_stats(). */
+	int trace;		/* Trace events kept per worker, or 0. */
+	sched_overflow_t overflow;	/* What to do when a queue is full. */
+	int max_queue_depth;	/* Cap for SCHED_OVERFLOW_GROW, or 0. */
+	int post_timeout;	/* Ms to block for SCHED_OVERFLOW_BLOCK. */
+	sched_policy_t policy;
+	sched_expire_fn_t expire;	/* Handles expired tasks, or NULL. */
+	struct sched *pool;	/* Run on this one's workers; see below. */
+	int weight;		/* Most of `pool's workers to use, or 0. */
+	uint64_t pool_pri;	/* Priority of our work within `pool'. */
+	int lazy;		/* Start workers as tasks back up; see below. */
+	size_t stack_size;	/* Worker stack size, or 0 for the default. */
+	int qos_weight[SCHED_QOS_CLASSES];	/* Tasks per round by class. */
+	uint64_t aging;		/* Ns of waiting worth a unit of `pri'. */
+} sched_attr_t;
+
 typedef struct priority_queue {
-	pthread_cond_t cv;
+	pthread_cond_t cv;		/* Signalled when work is available. */
+	pthread_cond_t drain_cv;	/* Signalled when all tasks finish. */
+	pthread_cond_t space_cv;	/* Signalled when tasks leave `heap'. */
+	int producers;			/* Waiting on `space_cv'. */
 	pthread_mutex_t lock;
 	heap_t *heap;
-	int remaining_tasks;
+	atomic_int queued;		/* Number of tasks in `heap'. */
+	atomic_int hwm;			/* Most tasks `heap' has held. */
+	_Atomic uint64_t top_pri;	/* Key at the top of `heap'. */
+	atomic_int remaining_tasks;
 } priority_queue_t;
 
+#define	SCHED_CACHE_LINE	64
+#define	SCHED_WORKER_SLOTS	(SCHED_CACHE_LINE / sizeof (void *))
+
+/*
+ * A log-linear histogram of nanosecond times, in the style of HdrHistogram.
+ * Each power of two is split into 2^SCHED_HIST_SUB_BITS equal buckets, so a
+ * recorded value is never off by more than 1 part in 8.
+ */
+#define	SCHED_HIST_SUB_BITS	3
+#define	SCHED_HIST_BUCKETS	((64 - SCHED_HIST_SUB_BITS + 1) << \
+	SCHED_HIST_SUB_BITS)
+
+typedef struct sched_hist {
+	_Atomic uint64_t count;
+	_Atomic uint64_t buckets[SCHED_HIST_BUCKETS];
+} sched_hist_t;
+
+/*
+ * Counters kept by each worker.  Only the worker itself ever writes them, and
+ * each worker's sit on cache lines of their own, so keeping them costs no
+ * more than the clock reads.  Times are in nanoseconds.
+ */
+typedef struct sched_worker_stats {
+	_Alignas(SCHED_CACHE_LINE) _Atomic uint64_t tasks;
+	_Atomic uint64_t busy_ns;	/* Running tasks. */
+	_Atomic uint64_t idle_ns;	/* Spinning or parked. */
+	_Atomic uint64_t steals;	/* Tasks taken from a peer's deque. */
+	_Atomic uint64_t wakeups;	/* Returns from parking. */
+	_Atomic uint64_t lock_wait_ns;	/* Waiting for a queue's lock. */
+	_Atomic uint64_t deque_hwm;	/* Deepest our deque has been. */
+	_Atomic uint64_t deadlines_met;
+	_Atomic uint64_t deadlines_missed;	/* Ran, but finished late. */
+	_Atomic uint64_t expired;	/* Dropped without running. */
+	sched_hist_t queue_wait;	/* From being queued to starting. */
+	sched_hist_t run_time;
+} sched_worker_stats_t;
+
+typedef enum sched_trace_type {
+	SCHED_TRACE_POST,
+	SCHED_TRACE_START,
+	SCHED_TRACE_END,
+	SCHED_TRACE_IDLE,	/* Going idle. */
+	SCHED_TRACE_BUSY	/* Coming back from idle. */
+} sched_trace_type_t;
+
+typedef struct sched_trace_event {
+	uint64_t ts;		/* CLOCK_MONOTONIC, in ns. */
+	const void *task;	/* Ties a task's post to its start. */
+	const char *name;
+	sched_trace_type_t type;
+	int tid;		/* Its track; see sched_trace_dump(). */
+} sched_trace_event_t;
+
+/*
+ * A ring of trace events that keeps the most recent `mask' + 1 of them.  Each
+ * worker has its own, and threads that are not workers share one more, though
+ * each of them still gets a track of its own.  Slots are claimed with a single
+ * fetch-and-add, so recording never takes a lock.
+ */
+typedef struct sched_trace_buf {
+	_Alignas(SCHED_CACHE_LINE) atomic_uint_fast64_t head;
+	uint64_t mask;
+	sched_trace_event_t *events;
+} sched_trace_buf_t;
+
+/*
+ * A snapshot taken by sched_stats().  The aggregate histograms cover every
+ * worker; `workers' must be handed back with sched_stats_release().
+ */
+typedef struct sched_stats {
+	int num_workers;
+	sched_worker_stats_t *workers;
+	uint64_t queue_hwm;		/* Deepest any task heap has been. */
+	sched_policy_t policy;		/* Deadlines were judged by it. */
+	uint64_t deadlines_met;
+	uint64_t deadlines_missed;
+	uint64_t expired;
+	sched_hist_t queue_wait;
+	sched_hist_t run_time;
+} sched_stats_t;
+
+/*
+ * Workers are cache-line aligned so that one worker's bookkeeping never shares
+ * a line with another's.  The `data' slots are free for applications to hang
+ * per-worker state off of; see sched_worker_slots().
+ */
+typedef struct worker {
+	_Alignas(SCHED_CACHE_LINE) pthread_t tid;
+	int id;
+	struct sched *sched;
+	deque_t deque;		/* Only used in SCHED_MODE_STEAL. */
+	int cpu;		/* CPU we are pinned to, or -1. */
+	int node;		/* NUMA node we run on, or SCHED_NODE_ANY. */
+	int spin;		/* Current spin budget, in rounds. */
+	bool running;		/* Whether a thread is serving this slot. */
+	bool joinable;		/* Whether `tid' still has to be joined. */
+	struct sched_async *async_free;	/* Our cache of sched_async() slots. */
+	int async_cached;
+	int help_depth;		/* Tasks run from within sched_sync(). */
+	_Alignas(SCHED_CACHE_LINE) void *data[SCHED_WORKER_SLOTS];
+} worker_t;
+
+/*
+ * Timers are kept on a wheel that counts in ticks of SCHED_TIMER_TICK ns since
+ * `base', and are fired by a thread of their own that is only started once the
+ * first timer is armed.
+ */
+#define	SCHED_TIMER_TICK	1000000
+
+typedef struct sched_timers {
+	pthread_mutex_t lock;
+	pthread_cond_t cv;		/* Signalled when `wakeup' moves up. */
+	wheel_t *wheel;
+	uint64_t base;			/* CLOCK_MONOTONIC at tick 0, in ns. */
+	uint64_t wakeup;		/* Tick the thread is sleeping until. */
+	pthread_t tid;
+	bool started;
+	bool done;
+} sched_timers_t;
+
+/*
+ * Slots for sched_async() tasks are carved out of slabs that live until
+ * sched_fini().  Each worker caches a few free slots of its own, and the rest
+ * sit on `free'.
+ */
+typedef struct sched_async_pool {
+	pthread_mutex_t lock;
+	struct sched_async *free;
+	struct sched_async_slab *slabs;
+} sched_async_pool_t;
+
 typedef struct sched {
 	priority_queue_t pq;
-	pthread_t *workers;
-	int num_workers;
-	sched_state_t state;
+	worker_t *workers;
+	int num_workers;	/* Size of `workers', running or not. */
+	int min_workers;	/* Workers that are always running. */
+	atomic_int live_workers;	/* Workers that are running. */
+	atomic_int blocked_workers;	/* Of those, how many are blocked. */
+	int idle_timeout;
+	ring_t fifo;		/* Lock-free lane for sched_post_fifo(). */
+	_Atomic sched_state_t state;
+	sched_mode_t mode;
+	atomic_int idle_workers;
+	atomic_int spinning_workers;	/* Idle, but not yet parked. */
+	int spin;		/* Configured spin budget. */
+	sched_overflow_t overflow;
+	int max_queue_depth;
+	int post_timeout;
+	sched_policy_t policy;
+	sched_expire_fn_t expire;
+	topology_t topo;
+	sched_affinity_t affinity;
+	priority_queue_t *node_pq;	/* Per-node queues, if `num_nodes'. */
+	int num_nodes;
+	sched_timers_t timers;
+	sched_worker_stats_t *stats;	/* One per worker, if enabled. */
+	sched_trace_buf_t *trace;	/* One per worker and one extra. */
+	sched_async_pool_t async;
+	struct sched *pool;	/* Whose workers run our tasks, if not ours. */
+	int weight;
+	uint64_t pool_pri;
+	atomic_int pumps;	/* Tasks running our queue on `pool'. */
+	int lazy;
+	atomic_int inline_runners;	/* Callers running tasks themselves. */
+	size_t stack_size;
+	priority_queue_t *qos_pq;	/* Heaps of the non-default classes. */
+	int num_qos_pq;
+	int qos_weight[SCHED_QOS_CLASSES];
+	atomic_int qos_credit[SCHED_QOS_CLASSES];
+	atomic_int qos_turn;		/* Class being served. */
+	uint64_t aging;
 } sched_t;
 
+/*
+ * A lazy scheduler starts no workers up front.  Another one is started
+ * whenever more than `lazy' tasks are outstanding for each thread that is
+ * running them, until all `num_workers' are, so a short burst of work never
+ * pays for threads it does not need.  Until then, sched_execute()'s caller
+ * runs tasks itself.  It is no worker, so they are handed -1 as their thread
+ * number, and sched_apply()'s helpers do no work when run this way.
+ */
+
+/*
+ * A scheduler can be attached to a pool instead of having workers of its own,
+ * by setting `pool' in its attributes.  It keeps its own queues, priorities,
+ * overflow policy and sched_execute(), but its tasks are run by the pool's
+ * workers, so any number of schedulers can share one set of threads.  Up to
+ * `weight' of the pool's workers serve it at once, and its work competes with
+ * the pool's other work at priority `pool_pri'.  Attached schedulers always
+ * use SCHED_MODE_SHARED, have no placement, and leave statistics to the pool.
+ * Tasks are handed the pool's worker numbers.  sched_global() is a pool with a
+ * worker per CPU that lasts for the life of the process.
+ */
+sched_t *sched_global(void);
+
 bool sched_init(sched_t *, int, int);
+bool sched_init_mode(sched_t *, int, int, sched_mode_t);
+void sched_attr_init(sched_attr_t *, int, int);
+bool sched_init_attr(sched_t *, const sched_attr_t *);
 bool sched_post(sched_t *, task_t *, bool);
+bool sched_post_fifo(sched_t *, task_t *, bool);
+bool sched_post_batch(sched_t *, task_t **, int, bool);
+bool sched_post_after(sched_t *, task_t *, task_t **, int, bool);
+bool sched_cancel(sched_t *, task_t *);
+bool sched_reprioritize(sched_t *, task_t *, uint64_t);
 void sched_execute(sched_t *);
 void sched_fini(sched_t *);
+bool sched_stats(sched_t *, sched_stats_t *);
+void sched_stats_release(sched_stats_t *);
+uint64_t sched_hist_value(const sched_hist_t *, double);
+bool sched_trace_dump(sched_t *, const char *);
+void sched_block_begin(void);
+void sched_block_end(void);
+int sched_current_worker(void);
+sched_t *sched_current(void);
+void **sched_worker_slots(sched_t *, int);
+
+/*
+ * The most bytes of closure that sched_async() will copy in to a task.
+ */
+#define	SCHED_ASYNC_INLINE	48
+
+typedef void (*sched_async_fn_t)(void *, int);
+
+bool sched_async(sched_t *, uint64_t, sched_async_fn_t, const void *, size_t);
+
+/*
+ * A group tracks a set of tasks independently of the scheduler-wide count that
+ * sched_execute() waits on, so that unrelated work sharing a scheduler does not
+ * have to wait for each other.
+ */
+typedef struct sched_group {
+	pthread_mutex_t lock;
+	pthread_cond_t cv;
+	atomic_int pending;
+	task_t *notify;		/* Tasks to post once `pending' drops to 0. */
+} sched_group_t;
+
+bool sched_group_init(sched_group_t *);
+void sched_group_destroy(sched_group_t *);
+void sched_group_enter(sched_group_t *);
+void sched_group_leave(sched_group_t *);
+bool sched_group_post(sched_group_t *, sched_t *, task_t *);
+void sched_group_wait(sched_group_t *);
+void sched_group_notify(sched_group_t *, sched_t *, task_t *);
+void sched_spawn(sched_t *, sched_group_t *, task_t *);
+void sched_sync(sched_t *, sched_group_t *);
+
+/*
+ * How sched_apply_part() carves up its iteration space.  Static splits it into
+ * one contiguous block per participant, dynamic hands out `grain'-sized chunks
+ * from a shared counter, and guided hands out chunks proportional to what is
+ * left, shrinking down to `grain'.
+ */
+typedef enum sched_partition {
+	SCHED_PART_STATIC,
+	SCHED_PART_DYNAMIC,
+	SCHED_PART_GUIDED
+} sched_partition_t;
+
+typedef void (*sched_apply_fn_t)(void *, size_t, size_t, int);
+
+void sched_apply(sched_t *, size_t, size_t, sched_apply_fn_t, void *);
+void sched_apply_part(sched_t *, size_t, size_t, sched_partition_t,
+    sched_apply_fn_t, void *);
+
+/*
+ * For sched_reduce(): a map function folds iterations [begin, end) in to the
+ * accumulator it is handed, and a combine function folds its second
+ * accumulator in to its first.  Both are handed the caller's `arg' first.
+ */
+typedef void (*sched_map_fn_t)(void *, size_t, size_t, void *, int);
+typedef void (*sched_combine_fn_t)(void *, void *, const void *);
+
+void sched_reduce(sched_t *, size_t, size_t, sched_map_fn_t,
+    sched_combine_fn_t, const void *, void *, size_t, void *);
+
+/*
+ * A serial queue runs its tasks one at a time, in the order they were posted,
+ * on whichever worker happens to be free.  The queue is scheduled on to the
+ * pool as a single unit of work, so it costs memory rather than a thread.
+ */
+typedef struct sched_queue {
+	sched_t *sched;
+	pthread_mutex_t lock;
+	task_t *head;
+	task_t *tail;
+	bool scheduled;		/* Whether `drain' is posted or running. */
+	task_t drain;
+} sched_queue_t;
+
+bool sched_queue_init(sched_queue_t *, sched_t *, uint64_t);
+void sched_queue_destroy(sched_queue_t *);
+bool sched_queue_post(sched_queue_t *, task_t *);
+
+/*
+ * A periodic timer posts its task every `period' ns until it is stopped.  It
+ * is not counted as outstanding work while it waits, so sched_execute() does
+ * not wait for it; only a run that has already been posted is waited for.
+ */
+typedef struct sched_timer {
+	sched_t *sched;
+	task_t *task;
+	uint64_t period;	/* In ticks. */
+	bool stopped;
+	task_t fire;		/* What actually sits on the wheel. */
+} sched_timer_t;
+
+bool sched_post_delayed(sched_t *, task_t *, uint64_t);
+bool sched_cancel_delayed(sched_t *, task_t *);
+void sched_timer_init(sched_timer_t *, sched_t *, task_t *);
+bool sched_timer_start(sched_timer_t *, uint64_t, uint64_t);
+bool sched_timer_stop(sched_timer_t *);
 
 #endif	/* SCHED_H_ */
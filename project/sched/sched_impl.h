@@ -0,0 +1,144 @@
+#ifndef	SCHED_IMPL_H_
+#define	SCHED_IMPL_H_
+
+#include "sched.h"
+
+/*
+ * Interfaces shared between the files that make up libsched, but not exposed
+ * to applications.
+ */
+
+/*
+ * Private task flags, kept clear of the public ones.  A task with
+ * TASK_TIMER_HOLD set is sitting on the timer wheel with a hold on
+ * `remaining_tasks', which is dropped once it has been posted.  TASK_RUN_NOW
+ * is the `run_now' a task was given by sched_post_after(), kept for when it
+ * becomes runnable.
+ */
+#define	TASK_TIMER_HOLD		0x10000
+#define	TASK_RUN_NOW		0x20000
+
+/*
+ * How many tasks deep a worker waiting in sched_sync() may stack up by
+ * running other work, and how long it naps between looks for more when there
+ * is none, in ns.
+ */
+#define	SCHED_HELP_DEPTH	32
+#define	SCHED_SYNC_NAP		1000000
+
+/* The scheduler whose workers run `sp's tasks. */
+#define	SCHED_HOST(sp)		((sp)->pool != NULL ? (sp)->pool : (sp))
+
+/*
+ * How many tasks a pump runs before giving the rest of its pool a turn, and
+ * how deep sched_global()'s queue starts out.
+ */
+#define	SCHED_PUMP_QUANTUM	64
+#define	SCHED_GLOBAL_DEPTH	256
+
+uint64_t sched_clock(void);
+void sched_post_never_wait(void);
+void sched_process_task(task_t *, int);
+bool sched_help(sched_t *, int);
+void sched_tasks_done(sched_t *, int);
+bool sched_timers_init(sched_t *);
+void sched_timers_fini(sched_t *);
+bool sched_stats_init(sched_t *, const sched_attr_t *);
+void sched_stats_fini(sched_t *);
+
+/*
+ * Hooks for collecting statistics.  `ws' is the calling worker's counters, or
+ * NULL if the scheduler is not collecting them.  With SCHED_STATS turned off
+ * they all compile away to nothing.
+ */
+#if SCHED_STATS
+
+/* Statistics are kept on the same time base as everything else. */
+#define	sched_stats_clock()	sched_clock()
+
+void sched_stats_ran(sched_worker_stats_t *, uint64_t, uint64_t, uint64_t);
+void sched_stats_lock(sched_worker_stats_t *, pthread_mutex_t *);
+
+/* Only the owning worker writes its counters, so no RMW is needed. */
+#define	STATS_ADD(field, n)	atomic_store_explicit(&(field),		\
+	atomic_load_explicit(&(field), memory_order_relaxed) +		\
+	    (n), memory_order_relaxed)
+
+#define	STATS_WORKER(sp, id)	((sp)->stats != NULL && (id) >= 0 ?	\
+	&(sp)->stats[id] : NULL)
+#define	STATS_CLOCK(ws)		((ws) != NULL ? sched_stats_clock() : 0)
+#define	STATS_POSTED(sp, tp)	((tp)->posted = (sp)->stats != NULL ?	\
+	sched_stats_clock() : 0)
+#define	STATS_INC(ws, field)	do {					\
+	if ((ws) != NULL)						\
+		STATS_ADD((ws)->field, 1);				\
+} while (0)
+#define	STATS_SINCE(ws, field, start)	do {				\
+	if ((ws) != NULL)						\
+		STATS_ADD((ws)->field, sched_stats_clock() - (start));	\
+} while (0)
+#define	STATS_MAX(ws, field, n)	do {					\
+	if ((ws) != NULL && (uint64_t)(n) > atomic_load_explicit(	\
+	    &(ws)->field, memory_order_relaxed))			\
+		atomic_store_explicit(&(ws)->field, (n),		\
+		    memory_order_relaxed);				\
+} while (0)
+#define	STATS_LOCK(ws, lock)	sched_stats_lock((ws), (lock))
+#define	STATS_RAN(ws, posted, start, deadline)	do {			\
+	if ((ws) != NULL)						\
+		sched_stats_ran((ws), (posted), (start), (deadline));	\
+} while (0)
+
+#else
+
+#define	STATS_WORKER(sp, id)	((sched_worker_stats_t *)NULL)
+#define	STATS_CLOCK(ws)		0
+#define	STATS_POSTED(sp, tp)	((void) 0)
+#define	STATS_INC(ws, field)	((void) 0)
+#define	STATS_SINCE(ws, field, start)	((void) (start))
+#define	STATS_MAX(ws, field, n)	((void) 0)
+#define	STATS_LOCK(ws, lock)	((void) pthread_mutex_lock(lock))
+#define	STATS_RAN(ws, posted, start, deadline)				\
+	((void) (posted), (void) (start), (void) (deadline))
+
+#endif	/* SCHED_STATS */
+
+/*
+ * A task posted by sched_async(), along with its copy of the closure.  The
+ * task comes first, so the slot is its own task's argument.
+ */
+typedef struct sched_async {
+	task_t task;
+	sched_t *sched;
+	sched_async_fn_t fn;
+	struct sched_async *next;	/* Chains free slots. */
+	_Alignas(16) unsigned char closure[SCHED_ASYNC_INLINE];
+} sched_async_t;
+
+bool sched_async_init(sched_t *);
+void sched_async_fini(sched_t *);
+
+bool sched_trace_init(sched_t *, const sched_attr_t *);
+void sched_trace_fini(sched_t *);
+
+/*
+ * Tracing hooks.  When tracing is off for a scheduler each costs a load and a
+ * branch; with SCHED_TRACE turned off they cost nothing at all.
+ */
+#if SCHED_TRACE
+
+void sched_trace_record(sched_t *, int, sched_trace_type_t, const void *,
+    const char *);
+
+#define	TRACE(sp, id, type, task, name)	do {				\
+	if ((sp)->trace != NULL)					\
+		sched_trace_record((sp), (id), (type), (task), (name));	\
+} while (0)
+
+#else
+
+#define	TRACE(sp, id, type, task, name)	((void) 0)
+
+#endif	/* SCHED_TRACE */
+
+#endif	/* SCHED_IMPL_H_ */
@@ -0,0 +1,252 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <assert.h>
+
+#include "sched.h"
+#include "sched_impl.h"
+
+
+#define	HIST_SUB	(1 << SCHED_HIST_SUB_BITS)
+
+#if SCHED_STATS
+/*
+ * Values below HIST_SUB get a bucket each.  Above that, the bucket is picked
+ * by the position of the highest set bit and the SCHED_HIST_SUB_BITS below it.
+ */
+static int
+hist_bucket(uint64_t v)
+{
+	int msb;
+
+	if (v < HIST_SUB)
+		return ((int)v);
+
+	msb = 63 - __builtin_clzll(v);
+	return (((msb - SCHED_HIST_SUB_BITS + 1) << SCHED_HIST_SUB_BITS) +
+	    (int)((v >> (msb - SCHED_HIST_SUB_BITS)) & (HIST_SUB - 1)));
+}
+#endif
+
+/* The largest value that lands in bucket `b'. */
+static uint64_t
+hist_bucket_max(int b)
+{
+	int shift;
+
+	if (b < HIST_SUB)
+		return ((uint64_t)b);
+
+	shift = (b >> SCHED_HIST_SUB_BITS) - 1;
+	return ((((uint64_t)(HIST_SUB + (b & (HIST_SUB - 1))) + 1) << shift) -
+	    1);
+}
+
+/*
+ * The value below which `pct' percent of the recorded values fall, to within
+ * the histogram's precision.  Returns 0 for an empty histogram.
+ */
+uint64_t
+sched_hist_value(const sched_hist_t *hp, double pct)
+{
+	uint64_t count, target, seen = 0;
+	int b;
+
+	assert(hp != NULL);
+
+	if ((count = atomic_load(&hp->count)) == 0)
+		return (0);
+
+	target = (uint64_t)(count * pct / 100.0);
+	target = target < 1 ? 1 : target > count ? count : target;
+
+	for (b = 0; b < SCHED_HIST_BUCKETS; b++) {
+		if ((seen += atomic_load(&hp->buckets[b])) >= target)
+			return (hist_bucket_max(b));
+	}
+
+	return (hist_bucket_max(SCHED_HIST_BUCKETS - 1));
+}
+
+#if SCHED_STATS
+
+static void
+hist_record(sched_hist_t *hp, uint64_t v)
+{
+	STATS_ADD(hp->buckets[hist_bucket(v)], 1);
+	STATS_ADD(hp->count, 1);
+}
+
+/*
+ * Account for a task that was queued at `posted' and started at `start', and
+ * has just finished, and whether it made its deadline if it had one.  Tasks
+ * queued before statistics were being kept have no queue time to record.
+ */
+void
+sched_stats_ran(sched_worker_stats_t *ws, uint64_t posted, uint64_t start,
+    uint64_t deadline)
+{
+	uint64_t end = sched_stats_clock();
+
+	STATS_ADD(ws->tasks, 1);
+	STATS_ADD(ws->busy_ns, end - start);
+	hist_record(&ws->run_time, end - start);
+
+	if (posted != 0 && posted <= start)
+		hist_record(&ws->queue_wait, start - posted);
+
+	if (deadline != 0 && end <= deadline)
+		STATS_ADD(ws->deadlines_met, 1);
+	else if (deadline != 0)
+		STATS_ADD(ws->deadlines_missed, 1);
+}
+
+/*
+ * Take `lock', timing how long it takes if it is contended.  The uncontended
+ * case costs a trylock and no clock reads.
+ */
+void
+sched_stats_lock(sched_worker_stats_t *ws, pthread_mutex_t *lock)
+{
+	uint64_t start;
+
+	if (ws == NULL || pthread_mutex_trylock(lock) == 0) {
+		if (ws == NULL)
+			(void) pthread_mutex_lock(lock);
+		return;
+	}
+
+	start = sched_stats_clock();
+	(void) pthread_mutex_lock(lock);
+	STATS_ADD(ws->lock_wait_ns, sched_stats_clock() - start);
+}
+
+#endif	/* SCHED_STATS */
+
+bool
+sched_stats_init(sched_t *sp, const sched_attr_t *ap)
+{
+	sp->stats = NULL;
+
+#if SCHED_STATS
+	if (ap->stats) {
+		if ((sp->stats = aligned_alloc(SCHED_CACHE_LINE,
+		    sizeof (sched_worker_stats_t) * ap->num_workers)) == NULL)
+			return (false);
+
+		bzero(sp->stats, sizeof (sched_worker_stats_t) *
+		    ap->num_workers);
+	}
+#endif
+
+	return (true);
+}
+
+void
+sched_stats_fini(sched_t *sp)
+{
+	free(sp->stats);
+}
+
+static void
+hist_copy(sched_hist_t *dst, sched_hist_t *src, sched_hist_t *sum)
+{
+	uint64_t v;
+	int b;
+
+	for (b = 0; b < SCHED_HIST_BUCKETS; b++) {
+		v = atomic_load_explicit(&src->buckets[b],
+		    memory_order_relaxed);
+		atomic_store_explicit(&dst->buckets[b], v,
+		    memory_order_relaxed);
+		atomic_store_explicit(&sum->buckets[b], v +
+		    atomic_load_explicit(&sum->buckets[b],
+		    memory_order_relaxed), memory_order_relaxed);
+	}
+
+	v = atomic_load_explicit(&src->count, memory_order_relaxed);
+	atomic_store_explicit(&dst->count, v, memory_order_relaxed);
+	atomic_store_explicit(&sum->count, v +
+	    atomic_load_explicit(&sum->count, memory_order_relaxed),
+	    memory_order_relaxed);
+}
+
+#define	STATS_COPY(dst, src, field)					\
+	atomic_store_explicit(&(dst)->field, atomic_load_explicit(	\
+	    &(src)->field, memory_order_relaxed), memory_order_relaxed)
+
+/*
+ * Take a snapshot of the scheduler's statistics.  Workers keep running while
+ * it is taken, so the counters are each up to date but not necessarily
+ * consistent with each other.  Fails if the scheduler is not collecting
+ * statistics, or they have been compiled out.
+ */
+bool
+sched_stats(sched_t *sp, sched_stats_t *stp)
+{
+	sched_worker_stats_t *src, *dst;
+	uint64_t hwm;
+	int i;
+
+	assert(sp != NULL && stp != NULL);
+
+	bzero(stp, sizeof (sched_stats_t));
+
+	if (sp->stats == NULL)
+		return (false);
+
+	if ((stp->workers = aligned_alloc(SCHED_CACHE_LINE,
+	    sizeof (sched_worker_stats_t) * sp->num_workers)) == NULL)
+		return (false);
+
+	stp->num_workers = sp->num_workers;
+	stp->policy = sp->policy;
+
+	for (i = 0; i < sp->num_workers; i++) {
+		src = &sp->stats[i];
+		dst = &stp->workers[i];
+
+		STATS_COPY(dst, src, tasks);
+		STATS_COPY(dst, src, busy_ns);
+		STATS_COPY(dst, src, idle_ns);
+		STATS_COPY(dst, src, steals);
+		STATS_COPY(dst, src, wakeups);
+		STATS_COPY(dst, src, lock_wait_ns);
+		STATS_COPY(dst, src, deque_hwm);
+		STATS_COPY(dst, src, deadlines_met);
+		STATS_COPY(dst, src, deadlines_missed);
+		STATS_COPY(dst, src, expired);
+		stp->deadlines_met += atomic_load(&dst->deadlines_met);
+		stp->deadlines_missed += atomic_load(&dst->deadlines_missed);
+		stp->expired += atomic_load(&dst->expired);
+		hist_copy(&dst->queue_wait, &src->queue_wait,
+		    &stp->queue_wait);
+		hist_copy(&dst->run_time, &src->run_time, &stp->run_time);
+	}
+
+	stp->queue_hwm = atomic_load(&sp->pq.hwm);
+
+	for (i = 0; i < sp->num_nodes; i++) {
+		if ((hwm = atomic_load(&sp->node_pq[i].hwm)) > stp->queue_hwm)
+			stp->queue_hwm = hwm;
+	}
+
+	for (i = 0; i < sp->num_qos_pq; i++) {
+		if ((hwm = atomic_load(&sp->qos_pq[i].hwm)) > stp->queue_hwm)
+			stp->queue_hwm = hwm;
+	}
+
+	return (true);
+}
+
+void
+sched_stats_release(sched_stats_t *stp)
+{
+	assert(stp != NULL);
+
+	free(stp->workers);
+	stp->workers = NULL;
+}
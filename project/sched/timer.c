@@ -0,0 +1,368 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "wheel.h"
+#include "sched.h"
+#include "sched_impl.h"
+
+
+#define	TIMER_NSEC	1000000000ULL
+
+/* The task a wheel entry is embedded in. */
+#define	TIMER_TASK(ep)	\
+	((task_t *)((char *)(ep) - offsetof(task_t, timer)))
+
+static uint64_t
+timer_tick(sched_timers_t *tsp)
+{
+	return ((sched_clock() - tsp->base) / SCHED_TIMER_TICK);
+}
+
+/*
+ * The first tick that begins at least `ns' from now.  Rounding up means a
+ * timer never fires early, at the cost of up to a tick's lateness.
+ */
+static uint64_t
+timer_expiry(sched_timers_t *tsp, uint64_t ns)
+{
+	return ((sched_clock() - tsp->base + ns + SCHED_TIMER_TICK - 1) /
+	    SCHED_TIMER_TICK);
+}
+
+static bool timer_arm(sched_t *, task_t *, uint64_t);
+
+/*
+ * Hand an expired task to the scheduler.  A worker is only woken if the
+ * scheduler is running; a stopped one stays stopped, and runs the task once
+ * sched_execute() is next called.  If the queue is full, the task goes back on
+ * the wheel to be tried again on the next tick, even under
+ * SCHED_OVERFLOW_BLOCK.  Running it here, or waiting for room, would hold up
+ * every other timer.  Only once the timers are being shut down is it
+ * dropped, like anything else still on the wheel.
+ */
+static void
+timer_post(sched_t *sp, task_t *tp)
+{
+	sched_timers_t *tsp = &sp->timers;
+	bool held = (tp->flags & TASK_TIMER_HOLD) != 0;
+	bool ret;
+
+	tp->flags &= ~TASK_TIMER_HOLD;
+
+	if (!sched_post(sp, tp, sp->state == SCHED_RUNNING)) {
+		(void) pthread_mutex_lock(&tsp->lock);
+
+		if ((ret = timer_arm(sp, tp, tsp->wheel->now)) && held)
+			tp->flags |= TASK_TIMER_HOLD;
+
+		(void) pthread_mutex_unlock(&tsp->lock);
+
+		if (ret)
+			return;
+	}
+
+	if (held)
+		sched_tasks_done(sp, 1);
+}
+
+static void *
+timer_thread(void *arg)
+{
+	sched_t *sp = arg;
+	sched_timers_t *tsp = &sp->timers;
+	wheel_entry_t *ep, *next;
+	struct timespec ts;
+	uint64_t when;
+
+	sched_post_never_wait();
+	(void) pthread_mutex_lock(&tsp->lock);
+
+	while (!tsp->done) {
+		if ((ep = wheel_advance(tsp->wheel, timer_tick(tsp))) != NULL) {
+			/*
+			 * The expired entries are off the wheel, so nobody
+			 * else will touch them until we have posted them.
+			 */
+			(void) pthread_mutex_unlock(&tsp->lock);
+
+			for (; ep != NULL; ep = next) {
+				next = ep->next;
+				timer_post(sp, TIMER_TASK(ep));
+			}
+
+			(void) pthread_mutex_lock(&tsp->lock);
+			continue;
+		}
+
+		tsp->wakeup = wheel_next(tsp->wheel);
+
+		if (tsp->wakeup == UINT64_MAX) {
+			(void) pthread_cond_wait(&tsp->cv, &tsp->lock);
+			continue;
+		}
+
+		when = tsp->base + tsp->wakeup * SCHED_TIMER_TICK;
+		ts.tv_sec = when / TIMER_NSEC;
+		ts.tv_nsec = when % TIMER_NSEC;
+		(void) pthread_cond_timedwait(&tsp->cv, &tsp->lock, &ts);
+	}
+
+	(void) pthread_mutex_unlock(&tsp->lock);
+	return (NULL);
+}
+
+bool
+sched_timers_init(sched_t *sp)
+{
+	sched_timers_t *tsp = &sp->timers;
+	pthread_condattr_t attr;
+
+	if (pthread_mutex_init(&tsp->lock, NULL) != 0)
+		return (false);
+
+	/* Deadlines are absolute, so they must not move with the wall clock. */
+	if (pthread_condattr_init(&attr) != 0) {
+		(void) pthread_mutex_destroy(&tsp->lock);
+		return (false);
+	}
+
+	(void) pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+	if (pthread_cond_init(&tsp->cv, &attr) != 0) {
+		(void) pthread_condattr_destroy(&attr);
+		(void) pthread_mutex_destroy(&tsp->lock);
+		return (false);
+	}
+
+	(void) pthread_condattr_destroy(&attr);
+	tsp->wheel = NULL;
+	tsp->base = sched_clock();
+	tsp->wakeup = UINT64_MAX;
+	tsp->started = false;
+	tsp->done = false;
+	return (true);
+}
+
+/*
+ * Stop the timer thread.  Anything still on the wheel is simply dropped.
+ */
+void
+sched_timers_fini(sched_t *sp)
+{
+	sched_timers_t *tsp = &sp->timers;
+
+	(void) pthread_mutex_lock(&tsp->lock);
+	tsp->done = true;
+	(void) pthread_cond_signal(&tsp->cv);
+	(void) pthread_mutex_unlock(&tsp->lock);
+
+	if (tsp->started)
+		(void) pthread_join(tsp->tid, NULL);
+
+	free(tsp->wheel);
+	(void) pthread_cond_destroy(&tsp->cv);
+	(void) pthread_mutex_destroy(&tsp->lock);
+}
+
+/*
+ * Put `tp' on the wheel, starting the timer thread if this is the first timer,
+ * and wake the thread if it is sleeping past the new expiry.  Must be called
+ * with `timers.lock' held.
+ */
+static bool
+timer_arm(sched_t *sp, task_t *tp, uint64_t expires)
+{
+	sched_timers_t *tsp = &sp->timers;
+
+	if (tsp->done)
+		return (false);
+
+	if (!tsp->started) {
+		if ((tsp->wheel = malloc(sizeof (wheel_t))) == NULL)
+			return (false);
+
+		wheel_init(tsp->wheel, timer_tick(tsp));
+
+		if (pthread_create(&tsp->tid, NULL, timer_thread, sp) != 0) {
+			free(tsp->wheel);
+			tsp->wheel = NULL;
+			return (false);
+		}
+
+		tsp->started = true;
+	}
+
+	wheel_insert(tsp->wheel, &tp->timer, expires);
+
+	if (expires < tsp->wakeup)
+		(void) pthread_cond_signal(&tsp->cv);
+
+	return (true);
+}
+
+/*
+ * Post `tp' once at least `ns' nanoseconds have passed.  Until then it counts
+ * as outstanding work, so sched_execute() will wait for it.  Insertion and
+ * cancellation cost the same however many timers are pending.
+ */
+bool
+sched_post_delayed(sched_t *sp, task_t *tp, uint64_t ns)
+{
+	sched_timers_t *tsp;
+	bool ret;
+
+	assert(sp != NULL && tp != NULL);
+
+	tsp = &sp->timers;
+	(void) atomic_fetch_add(&sp->pq.remaining_tasks, 1);
+
+	(void) pthread_mutex_lock(&tsp->lock);
+	tp->flags |= TASK_TIMER_HOLD;
+
+	if (!(ret = timer_arm(sp, tp, timer_expiry(tsp, ns))))
+		tp->flags &= ~TASK_TIMER_HOLD;
+
+	(void) pthread_mutex_unlock(&tsp->lock);
+
+	if (!ret)
+		sched_tasks_done(sp, 1);
+
+	return (ret);
+}
+
+/*
+ * Take a task posted with sched_post_delayed() back off of the wheel.  Returns
+ * false if it is too late, because the task has already been posted.
+ */
+bool
+sched_cancel_delayed(sched_t *sp, task_t *tp)
+{
+	sched_timers_t *tsp;
+	bool held;
+
+	assert(sp != NULL && tp != NULL);
+
+	tsp = &sp->timers;
+	(void) pthread_mutex_lock(&tsp->lock);
+
+	if (!wheel_pending(&tp->timer)) {
+		(void) pthread_mutex_unlock(&tsp->lock);
+		return (false);
+	}
+
+	wheel_remove(tsp->wheel, &tp->timer);
+	held = (tp->flags & TASK_TIMER_HOLD) != 0;
+	tp->flags &= ~TASK_TIMER_HOLD;
+	(void) pthread_mutex_unlock(&tsp->lock);
+
+	if (held)
+		sched_tasks_done(sp, 1);
+
+	return (true);
+}
+
+/*
+ * What a periodic timer posts.  The user's task is run from here and the timer
+ * put back on the wheel afterwards, so one run never overlaps the next.  Runs
+ * keep to the original schedule, but any that were missed while this one was
+ * late are skipped rather than fired back to back.
+ */
+static void
+timer_fire(void *arg, int thread_num)
+{
+	sched_timer_t *tmp = arg;
+	sched_timers_t *tsp = &tmp->sched->timers;
+	task_t *tp = tmp->task;
+	uint64_t expires, now;
+
+	tp->fptr(tp->args, thread_num);
+
+	(void) pthread_mutex_lock(&tsp->lock);
+
+	if (!tmp->stopped && !wheel_pending(&tmp->fire.timer)) {
+		expires = tmp->fire.timer.expires + tmp->period;
+		now = tsp->wheel->now;
+
+		if (expires < now) {
+			expires += (now - expires + tmp->period - 1) /
+			    tmp->period * tmp->period;
+		}
+
+		(void) timer_arm(tmp->sched, &tmp->fire, expires);
+	}
+
+	(void) pthread_mutex_unlock(&tsp->lock);
+}
+
+/*
+ * Set up a periodic timer for `tp'.  The task itself is never posted; each run
+ * calls its function on a task of the timer's own, at the task's priority.
+ */
+void
+sched_timer_init(sched_timer_t *tmp, sched_t *sp, task_t *tp)
+{
+	assert(tmp != NULL && sp != NULL && tp != NULL);
+
+	bzero(tmp, sizeof (sched_timer_t));
+	tmp->sched = sp;
+	tmp->task = tp;
+	task_init(&tmp->fire, tp->pri, timer_fire, tmp);
+	tmp->fire.node = tp->node;
+	tmp->fire.flags |= TASK_DETACHED;
+}
+
+/*
+ * Run the timer's task `delay' ns from now, and every `period' ns after that.
+ * Starting a timer that is already running reschedules it.
+ */
+bool
+sched_timer_start(sched_timer_t *tmp, uint64_t delay, uint64_t period)
+{
+	sched_timers_t *tsp;
+	bool ret;
+
+	assert(tmp != NULL && period > 0);
+
+	tsp = &tmp->sched->timers;
+	(void) pthread_mutex_lock(&tsp->lock);
+
+	if (wheel_pending(&tmp->fire.timer))
+		wheel_remove(tsp->wheel, &tmp->fire.timer);
+
+	tmp->period = (period + SCHED_TIMER_TICK - 1) / SCHED_TIMER_TICK;
+	tmp->stopped = false;
+	ret = timer_arm(tmp->sched, &tmp->fire, timer_expiry(tsp, delay));
+	(void) pthread_mutex_unlock(&tsp->lock);
+
+	return (ret);
+}
+
+/*
+ * Stop the timer from firing again.  A run that has already been posted still
+ * happens; once sched_execute() has returned, the timer may be freed.  Returns
+ * whether the timer was waiting to fire.
+ */
+bool
+sched_timer_stop(sched_timer_t *tmp)
+{
+	sched_timers_t *tsp;
+	bool ret;
+
+	assert(tmp != NULL);
+
+	tsp = &tmp->sched->timers;
+	(void) pthread_mutex_lock(&tsp->lock);
+	tmp->stopped = true;
+
+	if ((ret = wheel_pending(&tmp->fire.timer)))
+		wheel_remove(tsp->wheel, &tmp->fire.timer);
+
+	(void) pthread_mutex_unlock(&tsp->lock);
+	return (ret);
+}
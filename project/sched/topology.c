@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <assert.h>
+
+#include "topology.h"
+
+
+#define	TOPOLOGY_MAX_NODES	1024
+#define	BITS_PER_LONG		(8 * sizeof (unsigned long))
+
+/*
+ * Parse a kernel CPU list such as "0-3,8-11" into an array of CPU numbers.
+ * Returns the number of CPUs found, or -1 if the file can't be read.
+ */
+static int
+parse_cpulist(const char *path, int **cpusp)
+{
+	FILE *fp;
+	char buf[4096];
+	char *tok, *last;
+	int lo, hi, cpu;
+	int n = 0, size = 16;
+	int *cpus, *tmp;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return (-1);
+
+	if (fgets(buf, sizeof (buf), fp) == NULL) {
+		(void) fclose(fp);
+		return (-1);
+	}
+
+	(void) fclose(fp);
+
+	if ((cpus = malloc(sizeof (int) * size)) == NULL)
+		return (-1);
+
+	for (tok = strtok_r(buf, ",\n", &last); tok != NULL;
+	    tok = strtok_r(NULL, ",\n", &last)) {
+		if (sscanf(tok, "%d-%d", &lo, &hi) != 2) {
+			if (sscanf(tok, "%d", &lo) != 1)
+				continue;
+			hi = lo;
+		}
+
+		for (cpu = lo; cpu <= hi; cpu++) {
+			if (n == size) {
+				size *= 2;
+				if ((tmp = realloc(cpus,
+				    sizeof (int) * size)) == NULL) {
+					free(cpus);
+					return (-1);
+				}
+				cpus = tmp;
+			}
+			cpus[n++] = cpu;
+		}
+	}
+
+	*cpusp = cpus;
+	return (n);
+}
+
+static bool
+add_node(topology_t *tp, const char *path, int id)
+{
+	int *cpus;
+	int i, n;
+
+	if ((n = parse_cpulist(path, &cpus)) < 0)
+		return (false);
+
+	/* Memory-only nodes have no CPUs to run workers on. */
+	if (n == 0) {
+		free(cpus);
+		return (true);
+	}
+
+	tp->node_ids[tp->num_nodes] = id;
+	tp->node_cpus[tp->num_nodes] = cpus;
+	tp->node_ncpus[tp->num_nodes] = n;
+	tp->num_nodes++;
+
+	for (i = 0; i < n; i++) {
+		if (cpus[i] > tp->max_cpu)
+			tp->max_cpu = cpus[i];
+	}
+
+	return (true);
+}
+
+static bool
+add_kernel_node(topology_t *tp, const char *sysfs, int id)
+{
+	char path[256];
+
+	(void) snprintf(path, sizeof (path),
+	    "%s/devices/system/node/node%d/cpulist", sysfs, id);
+
+	return (add_node(tp, path, id));
+}
+
+/*
+ * Read the NUMA topology from `sysfs' (normally "/sys").  Allowing the root to
+ * be moved means placement can be exercised against a made-up topology on any
+ * machine.  Node IDs need not be contiguous, so the online list says which
+ * nodes there are; failing that, every possible node directory is tried.
+ */
+bool
+topology_load(topology_t *tp, const char *sysfs)
+{
+	char path[256];
+	int *ids;
+	int i, n, node;
+
+	assert(tp != NULL);
+
+	bzero(tp, sizeof (topology_t));
+
+	if (sysfs == NULL)
+		sysfs = "/sys";
+
+	if ((tp->node_cpus = malloc(sizeof (int *) *
+	    TOPOLOGY_MAX_NODES)) == NULL)
+		return (false);
+
+	if ((tp->node_ncpus = malloc(sizeof (int) *
+	    TOPOLOGY_MAX_NODES)) == NULL) {
+		free(tp->node_cpus);
+		return (false);
+	}
+
+	if ((tp->node_ids = malloc(sizeof (int) *
+	    TOPOLOGY_MAX_NODES)) == NULL) {
+		free(tp->node_cpus);
+		free(tp->node_ncpus);
+		return (false);
+	}
+
+	(void) snprintf(path, sizeof (path), "%s/devices/system/node/online",
+	    sysfs);
+
+	if ((n = parse_cpulist(path, &ids)) >= 0) {
+		for (i = 0; i < n; i++) {
+			if (ids[i] < 0 || ids[i] >= TOPOLOGY_MAX_NODES)
+				continue;
+
+			if (!add_kernel_node(tp, sysfs, ids[i])) {
+				free(ids);
+				topology_destroy(tp);
+				return (false);
+			}
+		}
+
+		free(ids);
+	} else {
+		for (node = 0; node < TOPOLOGY_MAX_NODES; node++) {
+			(void) snprintf(path, sizeof (path),
+			    "%s/devices/system/node/node%d/cpulist", sysfs,
+			    node);
+
+			if (access(path, R_OK) != 0)
+				continue;
+
+			if (!add_node(tp, path, node)) {
+				topology_destroy(tp);
+				return (false);
+			}
+		}
+	}
+
+	if (tp->num_nodes == 0) {
+		(void) snprintf(path, sizeof (path),
+		    "%s/devices/system/cpu/online", sysfs);
+
+		if (!add_node(tp, path, 0) || tp->num_nodes == 0) {
+			topology_destroy(tp);
+			return (false);
+		}
+	}
+
+	return (true);
+}
+
+void
+topology_destroy(topology_t *tp)
+{
+	int i;
+
+	assert(tp != NULL);
+
+	for (i = 0; i < tp->num_nodes; i++)
+		free(tp->node_cpus[i]);
+
+	free(tp->node_cpus);
+	free(tp->node_ncpus);
+	free(tp->node_ids);
+	bzero(tp, sizeof (topology_t));
+}
+
+/*
+ * The index of the node the kernel knows as `id', or -1 if we have no such
+ * node, or it has no CPUs.
+ */
+int
+topology_node_index(topology_t *tp, int id)
+{
+	int i;
+
+	assert(tp != NULL);
+
+	for (i = 0; i < tp->num_nodes; i++) {
+		if (tp->node_ids[i] == id)
+			return (i);
+	}
+
+	return (-1);
+}
+
+int
+topology_cpu_node(topology_t *tp, int cpu)
+{
+	int i, j;
+
+	assert(tp != NULL);
+
+	for (i = 0; i < tp->num_nodes; i++) {
+		for (j = 0; j < tp->node_ncpus[i]; j++) {
+			if (tp->node_cpus[i][j] == cpu)
+				return (i);
+		}
+	}
+
+	return (-1);
+}
+
+/*
+ * Restrict the calling thread to the given CPUs.  This goes straight to the
+ * system call so that we don't need cpu_set_t, which lives in the system's
+ * <sched.h> that our own header shadows for applications.
+ */
+bool
+topology_bind(const int *cpus, int ncpus)
+{
+	unsigned long *mask;
+	size_t len;
+	int i, max = 0;
+	long ret;
+
+	assert(cpus != NULL);
+
+	for (i = 0; i < ncpus; i++) {
+		if (cpus[i] > max)
+			max = cpus[i];
+	}
+
+	len = (max / BITS_PER_LONG + 1) * sizeof (unsigned long);
+
+	if ((mask = malloc(len)) == NULL)
+		return (false);
+
+	bzero(mask, len);
+
+	for (i = 0; i < ncpus; i++) {
+		if (cpus[i] >= 0)
+			mask[cpus[i] / BITS_PER_LONG] |=
+			    1UL << (cpus[i] % BITS_PER_LONG);
+	}
+
+	ret = syscall(SYS_sched_setaffinity, 0, len, mask);
+	free(mask);
+	return (ret == 0);
+}
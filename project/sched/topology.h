@@ -0,0 +1,27 @@
+#ifndef	_TOPOLOGY_H
+#define	_TOPOLOGY_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+/*
+ * The machine's NUMA layout, as read from sysfs.  A machine (or kernel)
+ * without NUMA support is described as a single node holding every online CPU.
+ * Nodes without CPUs are left out, so a node's index here need not be the ID
+ * the kernel knows it by; `node_ids' maps one to the other.
+ */
+typedef struct topology {
+	int num_nodes;
+	int *node_ids;		/* The kernel's ID for each node. */
+	int *node_ncpus;	/* Number of CPUs on each node. */
+	int **node_cpus;	/* The CPUs on each node. */
+	int max_cpu;		/* Highest CPU number seen on any node. */
+} topology_t;
+
+bool topology_load(topology_t *, const char *);
+void topology_destroy(topology_t *);
+int topology_cpu_node(topology_t *, int);
+int topology_node_index(topology_t *, int);
+bool topology_bind(const int *, int);
+
+#endif	/* _TOPOLOGY_H */
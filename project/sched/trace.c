@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <assert.h>
+
+#include "sched.h"
+#include "sched_impl.h"
+
+
+/* What a task without a name is called in the trace. */
+#define	TRACE_UNNAMED	"task"
+
+bool
+sched_trace_init(sched_t *sp, const sched_attr_t *ap)
+{
+#if SCHED_TRACE
+	uint64_t size = 2;
+	int i;
+#endif
+
+	sp->trace = NULL;
+
+#if SCHED_TRACE
+	if (ap->trace <= 0)
+		return (true);
+
+	/* Events are indexed with a mask, so round up to a power of two. */
+	while (size < (uint64_t)ap->trace)
+		size <<= 1;
+
+	if ((sp->trace = aligned_alloc(SCHED_CACHE_LINE,
+	    sizeof (sched_trace_buf_t) * (ap->num_workers + 1))) == NULL)
+		return (false);
+
+	for (i = 0; i <= ap->num_workers; i++) {
+		atomic_init(&sp->trace[i].head, 0);
+		sp->trace[i].mask = size - 1;
+
+		if ((sp->trace[i].events = calloc(size,
+		    sizeof (sched_trace_event_t))) == NULL) {
+			while (--i >= 0)
+				free(sp->trace[i].events);
+
+			free(sp->trace);
+			sp->trace = NULL;
+			return (false);
+		}
+	}
+#endif
+
+	return (true);
+}
+
+void
+sched_trace_fini(sched_t *sp)
+{
+	int i;
+
+	if (sp->trace == NULL)
+		return;
+
+	for (i = 0; i <= sp->num_workers; i++)
+		free(sp->trace[i].events);
+
+	free(sp->trace);
+	sp->trace = NULL;
+}
+
+#if SCHED_TRACE
+
+/*
+ * Threads that are not workers are numbered from 1 as they first record an
+ * event, so that each gets a track of its own.
+ */
+static atomic_int trace_threads;
+static __thread int trace_thread = 0;
+
+/*
+ * Record an event on worker `id's ring, or on the shared one if the caller is
+ * not one of `sp's workers, such as a pool worker running a task for an
+ * attached scheduler.  Once a ring is full the oldest events are overwritten.
+ */
+void
+sched_trace_record(sched_t *sp, int id, sched_trace_type_t type,
+    const void *task, const char *name)
+{
+	sched_trace_buf_t *bp;
+	sched_trace_event_t *ep;
+	uint64_t slot;
+
+	if (id < 0 || id >= sp->num_workers) {
+		if (trace_thread == 0)
+			trace_thread = atomic_fetch_add(&trace_threads, 1) + 1;
+
+		id = sp->num_workers + trace_thread - 1;
+	}
+
+	bp = &sp->trace[id < sp->num_workers ? id : sp->num_workers];
+	slot = atomic_fetch_add_explicit(&bp->head, 1, memory_order_relaxed);
+	ep = &bp->events[slot & bp->mask];
+
+	ep->ts = sched_clock();
+	ep->task = task;
+	ep->name = name;
+	ep->type = type;
+	ep->tid = id;
+}
+
+#endif	/* SCHED_TRACE */
+
+static void
+trace_name(FILE *fp, const char *name)
+{
+	const char *cp;
+
+	(void) fputc('"', fp);
+
+	for (cp = name != NULL ? name : TRACE_UNNAMED; *cp != '\0'; cp++) {
+		if (*cp == '"' || *cp == '\\')
+			(void) fputc('\\', fp);
+
+		if ((unsigned char)*cp >= 0x20)
+			(void) fputc(*cp, fp);
+	}
+
+	(void) fputc('"', fp);
+}
+
+/*
+ * How many task and idle slices are open on a track.  An end that finds none
+ * open belongs to a start that the ring has since overwritten, and is dropped
+ * so that the slices that are left still nest.
+ */
+typedef struct trace_track {
+	int tid;
+	int depth;
+} trace_track_t;
+
+/*
+ * The track for `tid', which is added, and named in the trace, the first time
+ * it turns up.  Returns NULL if there is no room for it.
+ */
+static trace_track_t *
+trace_track(FILE *fp, sched_t *sp, trace_track_t **tracksp, int *ntracksp,
+    int tid, bool *first)
+{
+	trace_track_t *tracks;
+	int i;
+
+	for (i = 0; i < *ntracksp; i++) {
+		if ((*tracksp)[i].tid == tid)
+			return (&(*tracksp)[i]);
+	}
+
+	if ((tracks = realloc(*tracksp,
+	    sizeof (trace_track_t) * (*ntracksp + 1))) == NULL)
+		return (NULL);
+
+	*tracksp = tracks;
+	tracks[*ntracksp].tid = tid;
+	tracks[*ntracksp].depth = 0;
+
+	(void) fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\","
+	    "\"pid\":1,\"tid\":%d,\"args\":{\"name\":", *first ? "" : ",",
+	    tid);
+
+	if (tid < sp->num_workers)
+		(void) fprintf(fp, "\"worker %d\"}}", tid);
+	else
+		(void) fprintf(fp, "\"external %d\"}}", tid - sp->num_workers);
+
+	*first = false;
+	return (&tracks[(*ntracksp)++]);
+}
+
+/*
+ * Write a single event.  Starts and ends of tasks, and of idle stretches,
+ * become duration events on the thread's track.  A post becomes a zero-length
+ * slice on the poster's track with a flow arrow to where the task started.
+ */
+static void
+trace_event(FILE *fp, trace_track_t *tp, sched_trace_event_t *ep, bool *first)
+{
+	double ts = ep->ts / 1000.0;
+	int tid = tp->tid;
+
+	switch (ep->type) {
+	case SCHED_TRACE_END:
+	case SCHED_TRACE_BUSY:
+		if (tp->depth == 0)
+			return;
+
+		tp->depth--;
+		break;
+	case SCHED_TRACE_START:
+	case SCHED_TRACE_IDLE:
+		tp->depth++;
+		break;
+	default:
+		break;
+	}
+
+	(void) fprintf(fp, "%s\n", *first ? "" : ",");
+	*first = false;
+
+	switch (ep->type) {
+	case SCHED_TRACE_POST:
+		(void) fprintf(fp, "{\"name\":\"post\",\"cat\":\"post\","
+		    "\"ph\":\"X\",\"dur\":0,\"pid\":1,\"tid\":%d,"
+		    "\"ts\":%.3f,\"args\":{\"task\":", tid, ts);
+		trace_name(fp, ep->name);
+		(void) fprintf(fp, "}},\n{\"name\":\"queued\",\"cat\":\"flow\","
+		    "\"ph\":\"s\",\"id\":\"%p\",\"pid\":1,\"tid\":%d,"
+		    "\"ts\":%.3f}", ep->task, tid, ts);
+		break;
+	case SCHED_TRACE_START:
+		(void) fprintf(fp, "{\"name\":");
+		trace_name(fp, ep->name);
+		(void) fprintf(fp, ",\"cat\":\"task\",\"ph\":\"B\",\"pid\":1,"
+		    "\"tid\":%d,\"ts\":%.3f},\n{\"name\":\"queued\","
+		    "\"cat\":\"flow\",\"ph\":\"f\",\"bp\":\"e\",\"id\":\"%p\","
+		    "\"pid\":1,\"tid\":%d,\"ts\":%.3f}", tid, ts, ep->task,
+		    tid, ts);
+		break;
+	case SCHED_TRACE_END:
+	case SCHED_TRACE_BUSY:
+		(void) fprintf(fp, "{\"ph\":\"E\",\"pid\":1,\"tid\":%d,"
+		    "\"ts\":%.3f}", tid, ts);
+		break;
+	case SCHED_TRACE_IDLE:
+		(void) fprintf(fp, "{\"name\":\"idle\",\"cat\":\"idle\","
+		    "\"ph\":\"B\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}", tid, ts);
+		break;
+	}
+}
+
+/*
+ * Write everything still held in the trace rings to `path' in the Chrome
+ * trace-event format, which chrome://tracing and Perfetto both open.  Every
+ * thread that recorded anything gets a track: workers by their index, and
+ * threads that are not workers, which share a ring, after them.  The scheduler
+ * should be quiescent, for example just after sched_execute(), and the trace
+ * has to be dumped before sched_fini().  Fails if tracing is off.
+ */
+bool
+sched_trace_dump(sched_t *sp, const char *path)
+{
+	sched_trace_buf_t *bp;
+	sched_trace_event_t *ep;
+	trace_track_t *tracks = NULL, *tp;
+	FILE *fp;
+	uint64_t head, i, size;
+	bool first = true;
+	int id, ntracks = 0;
+
+	assert(sp != NULL && path != NULL);
+
+	if (sp->trace == NULL || (fp = fopen(path, "w")) == NULL)
+		return (false);
+
+	(void) fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+	for (id = 0; id <= sp->num_workers; id++) {
+		bp = &sp->trace[id];
+		head = atomic_load(&bp->head);
+		size = bp->mask + 1;
+
+		for (i = head > size ? head - size : 0; i < head; i++) {
+			ep = &bp->events[i & bp->mask];
+
+			if ((tp = trace_track(fp, sp, &tracks, &ntracks,
+			    ep->tid, &first)) != NULL)
+				trace_event(fp, tp, ep, &first);
+		}
+	}
+
+	free(tracks);
+	(void) fprintf(fp, "\n]}\n");
+	return (fclose(fp) == 0);
+}
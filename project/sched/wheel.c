@@ -0,0 +1,205 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "wheel.h"
+
+
+/* The furthest ahead an entry can be placed, in ticks. */
+#define	WHEEL_SPAN	((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS))
+
+void
+wheel_init(wheel_t *wp, uint64_t now)
+{
+	assert(wp != NULL);
+
+	(void) bzero(wp, sizeof (wheel_t));
+	wp->now = now;
+}
+
+/*
+ * Link `ep' into the slot its expiry falls in, relative to the current tick.
+ * An entry lands in level `l' only if it is at least a whole slot of that level
+ * away, so its slot will not come round again before it is due.
+ */
+static void
+wheel_place(wheel_t *wp, wheel_entry_t *ep)
+{
+	uint64_t expires = ep->expires;
+	uint64_t delta;
+	wheel_entry_t **head;
+	int level, slot;
+
+	if (expires < wp->now)
+		expires = wp->now;
+
+	delta = expires - wp->now;
+
+	if (delta >= WHEEL_SPAN) {
+		delta = WHEEL_SPAN - 1;
+		expires = wp->now + delta;
+	}
+
+	for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+		if (delta < ((uint64_t)1 << (WHEEL_BITS * (level + 1))))
+			break;
+	}
+
+	slot = (expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+	head = &wp->slots[level][slot];
+
+	if ((ep->next = *head) != NULL)
+		ep->next->pprev = &ep->next;
+
+	*head = ep;
+	ep->pprev = head;
+	wp->occupied[level] |= (uint64_t)1 << slot;
+}
+
+/*
+ * Add `ep' to the wheel, to fire once tick `expires' has been processed.  An
+ * expiry that has already passed fires on the next call to wheel_advance().
+ */
+void
+wheel_insert(wheel_t *wp, wheel_entry_t *ep, uint64_t expires)
+{
+	assert(wp != NULL && ep != NULL && ep->pprev == NULL);
+
+	ep->expires = expires;
+	wheel_place(wp, ep);
+	wp->total++;
+}
+
+void
+wheel_remove(wheel_t *wp, wheel_entry_t *ep)
+{
+	wheel_entry_t **first = &wp->slots[0][0];
+	ptrdiff_t index;
+
+	assert(wp != NULL && ep != NULL && ep->pprev != NULL);
+
+	if ((*ep->pprev = ep->next) != NULL) {
+		ep->next->pprev = ep->pprev;
+	} else if (ep->pprev >= first &&
+	    ep->pprev < first + WHEEL_LEVELS * WHEEL_SIZE) {
+		/* We were the only entry in the slot. */
+		index = ep->pprev - first;
+		wp->occupied[index / WHEEL_SIZE] &=
+		    ~((uint64_t)1 << (index % WHEEL_SIZE));
+	}
+
+	ep->next = NULL;
+	ep->pprev = NULL;
+	wp->total--;
+}
+
+bool
+wheel_pending(wheel_entry_t *ep)
+{
+	assert(ep != NULL);
+
+	return (ep->pprev != NULL);
+}
+
+/*
+ * Empty a slot, handing back its entries as a list.
+ */
+static wheel_entry_t *
+wheel_take_slot(wheel_t *wp, int level, int slot)
+{
+	wheel_entry_t *ep = wp->slots[level][slot];
+
+	wp->slots[level][slot] = NULL;
+	wp->occupied[level] &= ~((uint64_t)1 << slot);
+	return (ep);
+}
+
+/*
+ * Move everything in one slot of `level' down to the levels below it.
+ */
+static void
+wheel_cascade(wheel_t *wp, int level, int slot)
+{
+	wheel_entry_t *ep, *next;
+
+	for (ep = wheel_take_slot(wp, level, slot); ep != NULL; ep = next) {
+		next = ep->next;
+		wheel_place(wp, ep);
+	}
+}
+
+/*
+ * Process every tick up to and including `now', returning the entries that
+ * have expired as a list chained through `next', in the order they expired.
+ * The returned entries are no longer in the wheel.
+ */
+wheel_entry_t *
+wheel_advance(wheel_t *wp, uint64_t now)
+{
+	wheel_entry_t *head = NULL;
+	wheel_entry_t **tail = &head;
+	wheel_entry_t *ep;
+	int level, slot;
+
+	assert(wp != NULL);
+
+	/* With nothing pending there is nothing to cascade, so just jump. */
+	if (wp->total == 0) {
+		if (now >= wp->now)
+			wp->now = now + 1;
+		return (NULL);
+	}
+
+	for (; wp->now <= now; wp->now++) {
+		slot = wp->now & WHEEL_MASK;
+
+		for (level = 1; slot == 0 && level < WHEEL_LEVELS; level++) {
+			slot = (wp->now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+			wheel_cascade(wp, level, slot);
+		}
+
+		slot = wp->now & WHEEL_MASK;
+
+		if (!(wp->occupied[0] & ((uint64_t)1 << slot)))
+			continue;
+
+		for (ep = wheel_take_slot(wp, 0, slot); ep != NULL;
+		    ep = ep->next) {
+			ep->pprev = NULL;
+			*tail = ep;
+			tail = &ep->next;
+			wp->total--;
+		}
+	}
+
+	*tail = NULL;
+	return (head);
+}
+
+/*
+ * A tick by which wheel_advance() should next be called, or UINT64_MAX if the
+ * wheel is empty.  This is exact when something is due before the bottom level
+ * comes round; otherwise it is the tick at which the next cascade happens.
+ */
+uint64_t
+wheel_next(wheel_t *wp)
+{
+	uint64_t pending;
+	int slot;
+
+	assert(wp != NULL);
+
+	if (wp->total == 0)
+		return (UINT64_MAX);
+
+	slot = wp->now & WHEEL_MASK;
+	pending = wp->occupied[0] >> slot;
+
+	if (pending != 0)
+		return (wp->now + __builtin_ctzll(pending));
+
+	return (wp->now + (WHEEL_SIZE - slot));
+}
@@ -0,0 +1,47 @@
+#ifndef	_WHEEL_H
+#define	_WHEEL_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+
+/*
+ * A hierarchical timing wheel.  Each level has WHEEL_SIZE slots, and each slot
+ * of a level spans a whole revolution of the level below it, so WHEEL_LEVELS
+ * levels cover 2^(WHEEL_BITS * WHEEL_LEVELS) ticks.  An entry goes in the
+ * lowest level whose range reaches its expiry and trickles down a level each
+ * time the wheel below comes round, so inserting and removing are O(1) no
+ * matter how many entries are pending.  Expiries further out than the wheel
+ * can reach are parked in the top level and placed again when it cascades.
+ */
+#define	WHEEL_BITS	6
+#define	WHEEL_SIZE	(1 << WHEEL_BITS)
+#define	WHEEL_MASK	(WHEEL_SIZE - 1)
+#define	WHEEL_LEVELS	4
+
+/*
+ * Entries are embedded in whatever is being timed.  `pprev' points at whatever
+ * points at us, and is NULL whenever the entry is not in the wheel.
+ */
+typedef struct wheel_entry {
+	struct wheel_entry *next;
+	struct wheel_entry **pprev;
+	uint64_t expires;		/* Tick at which the entry fires. */
+} wheel_entry_t;
+
+typedef struct wheel {
+	uint64_t now;			/* The next tick to be processed. */
+	uint64_t total;			/* Number of entries in the wheel. */
+	uint64_t occupied[WHEEL_LEVELS];	/* Bitmap of non-empty slots. */
+	wheel_entry_t *slots[WHEEL_LEVELS][WHEEL_SIZE];
+} wheel_t;
+
+void wheel_init(wheel_t *, uint64_t);
+void wheel_insert(wheel_t *, wheel_entry_t *, uint64_t);
+void wheel_remove(wheel_t *, wheel_entry_t *);
+bool wheel_pending(wheel_entry_t *);
+wheel_entry_t *wheel_advance(wheel_t *, uint64_t);
+uint64_t wheel_next(wheel_t *);
+
+#endif	/* _WHEEL_H */
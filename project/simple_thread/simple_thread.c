@@ -18,7 +18,8 @@ simple_thread(void *arg, int thread_num)
 
 	assert(arg != NULL);
 
-	shared_variable = (int *)arg;
+	/* Our argument is the scheduler's copy of the pointer we posted. */
+	shared_variable = *(int **)arg;
 
 	for (num = 0; num < 20; num++) {
 #ifdef	PTHREAD_SYNC
@@ -35,6 +36,22 @@ simple_thread(void *arg, int thread_num)
 	}
 }
 
+/*
+ * The same count without the race: each worker counts in to an accumulator of
+ * its own, and sched_reduce() adds them up once they are done.
+ */
+void
+count_map(void *arg, size_t begin, size_t end, void *acc, int thread_num)
+{
+	*(int *)acc += (int)(end - begin);
+}
+
+void
+count_combine(void *arg, void *acc, const void *other)
+{
+	*(int *)acc += *(const int *)other;
+}
+
 bool
 validate_arg(int len, char **args)
 {
@@ -55,10 +72,12 @@ int main(int argc, char **argv)
 	int i;
 	bool ret;
 	sched_t sched;
-	task_t *tasks;
 	int nthreads;
 	int queue_depth;
 	int val = 0;
+	int *valp = &val;
+	int zero = 0;
+	int total;
 
 	if (!validate_arg(argc, argv)) {
 		printf("Invalid arguments supplied.\n");
@@ -67,11 +86,6 @@ int main(int argc, char **argv)
 
 	queue_depth = nthreads = atoi(argv[1]);
 
-	if ((tasks = malloc(sizeof (task_t) * nthreads)) == NULL) {
-		printf("Memory allocation failure.\n");
-		exit(-1);
-	}
-
 #ifdef	PTHREAD_SYNC
 	if (pthread_mutex_init(&lock, NULL) != 0) {
 		printf("Mutex initialization failed.\n");
@@ -90,20 +104,24 @@ int main(int argc, char **argv)
 
 	for (i = 0; i < nthreads; i++) {
 		/*
-		 * Initialize a task.  Give it a priority of 1, specify that we
-		 * want the task to run `simple_thread()' and the address of the
-		 * argument that should be supplied to it is the address of the
-		 * integer `val` which was allocated on the stack of `main()`.
+		 * Post a task with a priority of 1 that runs `simple_thread()'.
+		 * The scheduler keeps its own copy of the closure, which here
+		 * is just the address of the integer `val' on the stack of
+		 * `main()', so there is no task for us to allocate or keep
+		 * around.
 		 */
-		task_init(&tasks[i], 1, simple_thread, (void *)&val);
-
-		/* Insert the task in to the schedulers task queue. */
-		(void) sched_post(&sched, &tasks[i], false);
+		(void) sched_async(&sched, 1, simple_thread, &valp,
+		    sizeof (valp));
 	}
 
 	/* Begin execution of all tasks and block until they are finished. */
 	sched_execute(&sched);
 
+	sched_reduce(&sched, nthreads * 20, 1, count_map, count_combine, &zero,
+	    &total, sizeof (total), NULL);
+	printf("Shared counter reached %d; sched_reduce() counted %d.\n", val,
+	    total);
+
 	/* Destroy our scheduler -- we are done. */
 	sched_fini(&sched);
 
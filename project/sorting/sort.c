@@ -6,7 +6,11 @@
 #include <sched.h>
 
 
+/* Slices smaller than this are not worth forking off. */
+#define	SERIAL_CUTOFF	8
+
 typedef struct array_slice {
+	sched_t *sched;
 	int *array;
 	int left;
 	int right;
@@ -26,27 +30,14 @@ print_array(int *array, int len)
 }
 
 void
-slice_init(array_slice_t *sp, int *array, int left, int right)
+slice_init(array_slice_t *sp, sched_t *sched, int *array, int left, int right)
 {
+	sp->sched = sched;
 	sp->array = array;
 	sp->left = left;
 	sp->right = right;
 }
 
-void
-array_to_slice(int *array, int len, array_slice_t *slices)
-{
-	int i;
-	int left = len / 2;
-	int right = left;
-
-	if (len % 2 == 0)
-		right--;
-
-	slice_init(&slices[0], array, 0, left - 1);
-	slice_init(&slices[1], array, left, left + right);
-}
-
 void
 swap(int *array, int x, int y)
 {
@@ -55,84 +46,100 @@ swap(int *array, int x, int y)
 	array[x] = (array[x] + array[y]) - (array[y] = array[x]);
 }
 
+/*
+ * Partition around the middle element, returning where it ends up.
+ */
 int
-left_child(int i)
-{
-	return (i * 2 + 1);
-}
-
-void
-heap_sift_down(int *array, int i, int len)
+partition(int *array, int left, int right)
 {
-	int tmp, child;
-
-	for (tmp = array[i]; left_child(i) < len; i = child) {
-		child = left_child(i);
-
-		if (child != len - 1 && array[child] < array[child + 1])
-			child++;
+	int last, i;
 
-		if (tmp >= array[child])
-			break;
+	swap(array, left, (left + right) / 2);
+	last = left;
 
-		array[i] = array[child];
-	}
+	for (i = left + 1; i <= right; i++)
+		if (array[i] < array[left])
+			swap(array, ++last, i);
 
-	array[i] = tmp;
+	swap(array, left, last);
+	return (last);
 }
 
 void
-heapify(int *array, int len)
+quicksort(int *array, int left, int right)
 {
-	int i;
+	int last;
+
+	if (left >= right)
+		return;
 
-	for (i = len / 2; i >= 0; i--)
-		heap_sift_down(array, i, len);
+	last = partition(array, left, right);
+	quicksort(array, left, last - 1);
+	quicksort(array, last + 1, right);
 }
 
+/*
+ * Sort a slice by forking off the left half and sorting the right half here,
+ * then joining.  The join runs other pending slices while it waits, so every
+ * worker can be in the middle of one of these without the pool stalling.
+ */
 void
-heap_sort(int *array, int len)
+sort_func(void *arg, int thread_num)
 {
-	int i;
+	array_slice_t *sp;
+	array_slice_t halves[2];
+	sched_group_t group;
+	task_t task;
+	int last;
 
-	heapify(array, len + 1);
+	assert(arg != NULL);
 
-	for (i = len; i > 0; i--) {
-		swap(array, i, 0);
-		heap_sift_down(array, 0, i);
+	sp = arg;
+
+	if (sp->right - sp->left < SERIAL_CUTOFF) {
+		quicksort(sp->array, sp->left, sp->right);
+		return;
 	}
+
+	last = partition(sp->array, sp->left, sp->right);
+	slice_init(&halves[0], sp->sched, sp->array, sp->left, last - 1);
+	slice_init(&halves[1], sp->sched, sp->array, last + 1, sp->right);
+
+	(void) sched_group_init(&group);
+	task_init(&task, 1, sort_func, (void *)&halves[0]);
+	sched_spawn(sp->sched, &group, &task);
+	sort_func(&halves[1], thread_num);
+	sched_sync(sp->sched, &group);
+	sched_group_destroy(&group);
 }
 
+/*
+ * The other way to sort: split the array in two, sort each half in a task of
+ * its own, and merge them in a third task that sched_post_after() holds back
+ * until both halves are done.  Run with "merge" as the last argument.
+ */
 void
-quicksort(int *array, int left, int right)
+array_to_slice(int *array, int len, array_slice_t *slices)
 {
-	int last, i;
-
-	if (left >= right)
-		return;
-
-	swap(array, left, (left + right) / 2);
-	last = left;
+	int left = len / 2;
+	int right = left;
 
-	for (i = left + 1; i <= right; i++)
-		if (array[i] < array[left])
-			swap(array, ++last, i);
+	if (len % 2 == 0)
+		right--;
 
-	swap(array, left, last);
-	quicksort(array, left, last - 1);
-	quicksort(array, last + 1, right);
+	slice_init(&slices[0], NULL, array, 0, left - 1);
+	slice_init(&slices[1], NULL, array, left, left + right);
 }
 
 void
-sort_func(void *arg, int thread_num)
+half_func(void *arg, int thread_num)
 {
 	array_slice_t *sp;
 
 	assert(arg != NULL);
 
 	sp = arg;
-	heap_sort(sp->array + sp->left, sp->right - sp->left);
-//	quicksort(sp->array, sp->left, sp->right);
+	quicksort(sp->array, sp->left, sp->right);
 }
 
 void
@@ -178,6 +185,33 @@ merge_func(void *arg, int thread_num)
 	merge(slices[0].array, 0, slices[1].left, slices[1].right);
 }
 
+void
+sort_merge(sched_t *sched, int *array, int len)
+{
+	array_slice_t slices[2];
+	task_t tasks[2];
+	task_t merge_task;
+	task_t *deps[2];
+	int i;
+
+	array_to_slice(array, len, slices);
+
+	for (i = 0; i < 2; i++) {
+		task_init(&tasks[i], 1, half_func, (void *)&slices[i]);
+		(void) sched_post(sched, &tasks[i], false);
+		deps[i] = &tasks[i];
+	}
+
+	/*
+	 * The merge depends on both halves being sorted, so let the scheduler
+	 * start it as soon as the second one finishes rather than waiting on a
+	 * barrier in between.
+	 */
+	task_init(&merge_task, 1, merge_func, (void *)slices);
+	(void) sched_post_after(sched, &merge_task, deps, 2, false);
+	sched_execute(sched);
+}
+
 void
 help_check(int *array, int len)
 {
@@ -193,11 +227,11 @@ void main(int argc, char **argv)
 	int  len;
 	int *array;
 	int threads;
-	array_slice_t slices[2];
+	array_slice_t slice;
 	sched_t sched_sort;
-	task_t tasks[2];
+	task_t task;
 
-	if (argc != 3) {
+	if (argc != 3 && (argc != 4 || strcmp(argv[3], "merge") != 0)) {
 		printf("Mising length of array or number of threads.\n");
 		exit(-1);
 	}
@@ -214,18 +248,21 @@ void main(int argc, char **argv)
 
 	print_array(array, len);
 
-	sched_init(&sched_sort, threads, 2);
-	array_to_slice(array, len, slices);
-
-	for (i = 0; i < 2; i++) {
-		task_init(&tasks[i], 1, sort_func, (void *)&slices[i]);
-		(void) sched_post(&sched_sort, &tasks[i], false);
+	sched_init(&sched_sort, threads, 64);
+
+	if (argc == 4) {
+		sort_merge(&sched_sort, array, len);
+	} else {
+		/*
+		 * The whole sort is one task, which forks the rest of itself
+		 * off as it goes; see sort_func().
+		 */
+		slice_init(&slice, &sched_sort, array, 0, len - 1);
+		task_init(&task, 1, sort_func, (void *)&slice);
+		(void) sched_post(&sched_sort, &task, false);
+		sched_execute(&sched_sort);
 	}
-	sched_execute(&sched_sort);
 
-	task_init(&tasks[0], 1, merge_func, (void *)slices);
-	(void) sched_post(&sched_sort, &tasks[0], false);
-	sched_execute(&sched_sort);
 	sched_fini(&sched_sort);
 
 	help_check(array, len);
@@ -48,8 +48,10 @@ void main(int argc, char **argv)
 	char *fname;
 	char symbol[20];
 	sched_t scheduler;
+	sched_attr_t attr;
 	stock_stat_t header;
 	task_t *tasks;
+	task_t **batch;
 
 	if (argc != 3) {
 		usage();
@@ -83,18 +85,29 @@ void main(int argc, char **argv)
 	}
 	bzero(tasks, sizeof (task_t) * total);
 
-	/* Start the scheduler. */
-	(void) sched_init(&scheduler, threads, total);
+	if ((batch = malloc(sizeof (task_t *) * total)) == NULL) {
+		printf("Failed to allocate storage for tasks.\n");
+		exit (-1);
+	}
+
+	/*
+	 * Start the scheduler.  The fetches spend most of their time blocked,
+	 * so let the pool grow past `threads' while they wait.
+	 */
+	sched_attr_init(&attr, threads, total);
+	attr.max_workers = threads * 4;
+	(void) sched_init_attr(&scheduler, &attr);
 
 	(void) fseek(fp, 0L, SEEK_SET);
 
 	for (i = 0; fgets(portfolio[i].symbol, MAXNAME, fp) != NULL; i++) {
 		portfolio[i].symbol[strlen(portfolio[i].symbol) - 1] = 0;
 		task_init(&tasks[i], 1, stock_func, (void *)&portfolio[i]);
-
-		(void) sched_post(&scheduler, &tasks[i], false);
+		batch[i] = &tasks[i];
 	}
 
+	(void) sched_post_batch(&scheduler, batch, i, false);
+
 	/* Block until the scheduler has finished processing all tasks. */
 	sched_execute(&scheduler);
 
@@ -110,6 +123,7 @@ void main(int argc, char **argv)
 		print_stat(&portfolio[i]);
 
 	sched_fini(&scheduler);
+	free(batch);
 }
 
 static int
@@ -237,8 +251,15 @@ stock_func(void *arg, int thread_num)
 	 */
 	curl_easy_setopt(ctx, CURLOPT_USERAGENT, "libcurl-agent/1.0");
 
-	/* Send the request */
-	if ((res = curl_easy_perform(ctx)) != CURLE_OK) {
+	/*
+	 * Send the request.  This blocks for as long as the server takes to
+	 * answer, so let the scheduler put another worker on our CPU.
+	 */
+	sched_block_begin();
+	res = curl_easy_perform(ctx);
+	sched_block_end();
+
+	if (res != CURLE_OK) {
 		fprintf(stderr, "curl_easy_perform() failed: %s\n",
 		    curl_easy_strerror(res));
 	}
@@ -212,6 +212,7 @@ validate_sudoku_map(sched_t *sp, int **matrix)
 	int row, col;
 	sched_t sched_sudoku;
 	task_t tasks[TOTAL_TASKS];
+	task_t *batch[TOTAL_TASKS];
 	map_t args[TOTAL_TASKS];
 
 	for (col = 0; col < 9; col += 3) {
@@ -221,7 +222,7 @@ validate_sudoku_map(sched_t *sp, int **matrix)
 			args[i].coords.col = col;
 			task_init(&tasks[i], 1, validate_3_by_3_func,
 			    (void *)&args[i]);
-			(void) sched_post(sp, &tasks[i], false);
+			batch[i] = &tasks[i];
 			i++;
 		}
 	}
@@ -231,9 +232,11 @@ validate_sudoku_map(sched_t *sp, int **matrix)
 		task_init(&tasks[i], 1,
 		    (i % 2) ? validate_rows_func : validate_cols_func,
 		    (void *)&args[i]);
-		(void) sched_post(sp, &tasks[i], false);
+		batch[i] = &tasks[i];
 	}
 
+	/* Post every task under a single acquisition of the queue lock. */
+	(void) sched_post_batch(sp, batch, TOTAL_TASKS, false);
 	sched_execute(sp);
 	for (i = 0; i < TOTAL_TASKS; i++) {
 		if (!args[i].valid)